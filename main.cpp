@@ -1,65 +1,184 @@
 ﻿// tomasulo_sim.cpp
 // Tomasulo-style simulator (single-file C++17)
 // Input: decoded program file and memory file (optional).
-// Compile: g++ -std=c++17 tomasulo_sim.cpp -O2 -o tomasulo_sim
+// Compile: g++ -std=c++17 tomasulo_sim.cpp -O2 -pthread -o tomasulo_sim
 // Run: ./tomasulo_sim program.txt memory.txt
+// Library (libtomasulo, API in tomasulo.h):
+//   g++ -std=c++17 tomasulo_sim.cpp -O2 -pthread -fPIC -shared -DTOMASULO_LIBRARY -o libtomasulo.so
+// -DTOMASULO_NO_PROFILE leaves out the --profile stage probes.
 
 #include <bits/stdc++.h>
+#include "tomasulo.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <x86intrin.h>
+#endif
 using namespace std;
 
 // ---------------- Configuration ----------------
-const int NUM_REG = 8;      // R0..R7 (R0 == 0)
-const int MEM_SIZE = 64000; // word-addressable
-const int ROB_SIZE = 8;     // changeable ROB size
-const int ISSUE_WIDTH = 1;  // single-issue
-const int DEFAULT_MAX_CYCLES = 1000000;
-const int MAX_EXECUTIONS = 50; // cap total committed executions
-
-// Operation latencies (cycles)
+const int MEM_SIZE = 1 << 16; // word-addressable, full 16-bit address space
+const long long DEFAULT_MAX_CYCLES = 1000000;
+const long long DEFAULT_MAX_COMMITS = 50; // cap total committed executions (0 = no cap)
+const size_t DEFAULT_HISTORY = 1000;      // committed executions kept for the report
+
+// Opcodes, reservation-station families and ROB entry kinds
+enum class Op : uint8_t
+{
+    NONE = 0,
+    LOAD = 1,
+    STORE = 2,
+    BEQ = 3,
+    ADD = 4,
+    SUB = 5,
+    NAND = 6,
+    MUL = 7,
+    CALL = 8,
+    RET = 9,
+    HALT = 10
+};
+const int NUM_OPCODES = 11; // valid opcodes are 1..NUM_OPCODES-1
+
+enum class RSFamily : uint8_t
+{
+    LOAD,
+    STORE,
+    BR,
+    ADD, // covers ADD/SUB
+    NAND,
+    MUL,
+    CALL,
+    RET,
+    COUNT
+};
+const int NUM_RS_FAMILIES = (int)RSFamily::COUNT;
+constexpr const char* RS_FAMILY_NAMES[NUM_RS_FAMILIES] = { "LOAD", "STORE", "BR", "ADD", "NAND", "MUL", "CALL", "RET" };
+
+enum class ROBType : uint8_t
+{
+    NONE,
+    REG,
+    STORE,
+    BR,
+    CALL,
+    RET,
+    HALT
+};
+
+// Operation latencies (cycles) and decode properties, indexed by opcode
 struct OpInfo
 {
-    string name;
+    const char* name;
     int exec_latency;
     int commit_latency;
+    RSFamily family;
+    ROBType rob_type;
 };
-const unordered_map<int, OpInfo> OPCODES = {
-    {1, {"LOAD", 6, 1}},
-    {2, {"STORE", 1, 4}},
-    {3, {"BEQ", 1, 1}},
-    {4, {"ADD", 2, 1}},
-    {5, {"SUB", 2, 1}},
-    {6, {"NAND", 1, 1}},
-    {7, {"MUL", 12, 1}},
-    {8, {"CALL", 1, 1}},
-    {9, {"RET", 1, 1}} };
-
-// mapping opcode to RS family name
-string opcodeRSFamily(int opcode)
-{
-    auto it = OPCODES.find(opcode);
-    if (it == OPCODES.end())
-        return "OTHER";
-    string op = it->second.name;
-    if (op == "LOAD")
-        return "LOAD";
-    if (op == "STORE")
-        return "STORE";
-    if (op == "BEQ")
-        return "BR";
-    if (op == "ADD" || op == "SUB")
-        return "ADD";
-    if (op == "NAND")
-        return "NAND";
-    if (op == "MUL")
-        return "MUL";
-    if (op == "CALL")
-        return "CALL";
-    if (op == "RET")
-        return "RET";
-    return "OTHER";
-}
+constexpr OpInfo OPCODES[NUM_OPCODES] = {
+    {"UNK", 0, 0, RSFamily::COUNT, ROBType::NONE},
+    {"LOAD", 6, 1, RSFamily::LOAD, ROBType::REG},
+    {"STORE", 1, 4, RSFamily::STORE, ROBType::STORE},
+    {"BEQ", 1, 1, RSFamily::BR, ROBType::BR},
+    {"ADD", 2, 1, RSFamily::ADD, ROBType::REG},
+    {"SUB", 2, 1, RSFamily::ADD, ROBType::REG},
+    {"NAND", 1, 1, RSFamily::NAND, ROBType::REG},
+    {"MUL", 12, 1, RSFamily::MUL, ROBType::REG},
+    {"CALL", 1, 1, RSFamily::CALL, ROBType::CALL},
+    {"RET", 1, 1, RSFamily::RET, ROBType::RET},
+    {"HALT", 0, 1, RSFamily::COUNT, ROBType::HALT} }; // no RS: done at issue
+
+constexpr bool valid_opcode(int opcode) { return opcode > 0 && opcode < NUM_OPCODES; }
+constexpr const char* opcode_name(int opcode) { return valid_opcode(opcode) ? OPCODES[opcode].name : "UNK"; }
+
+// reservation stations per family
+constexpr int RS_COUNTS[NUM_RS_FAMILIES] = {
+    2, // LOAD
+    1, // STORE
+    2, // BR
+    4, // ADD (ADD/SUB)
+    2, // NAND
+    1, // MUL
+    1, // CALL
+    1, // RET
+};
+
+// branch direction predictors (see "Branch prediction")
+enum class BPKind : uint8_t
+{
+    NOT_TAKEN,
+    BIMODAL,
+    GSHARE,
+    TAGE,
+    COUNT
+};
+const int NUM_BP_KINDS = (int)BPKind::COUNT;
+constexpr const char* BP_NAMES[NUM_BP_KINDS] = { "not-taken", "bimodal", "gshare", "tage" };
+
+// Machine parameters, set at startup (see "Machine configuration"); the
+// defaults are the tables above
+struct MachineConfig
+{
+    int num_reg = 8;     // R0..R(num_reg-1), R0 == 0
+    int rob_size = 8;
+    int issue_width = 1; // single-issue
+    int cdb_count = 1;   // common data buses: results written per cycle
+    int commit_width = 0; // ROB entries committed per cycle, 0 = the original unbounded stage
+    int exec_latency[NUM_OPCODES];
+    int commit_latency[NUM_OPCODES];
+    int rs_counts[NUM_RS_FAMILIES];
+    BPKind bp = BPKind::NOT_TAKEN;
+    int bp_entries = 1024;         // counters per predictor table, a power of two
+    int btb_entries = 64;          // direct-mapped BTB, 0 = targets come straight from decode
+    bool resolve_at_write = false; // detect mispredictions when the branch writes, not at commit
+    bool bp_compare = false;       // also score every predictor on the committed branches
+    int ras_entries = 0;           // return address stack depth, 0 = RET resolves at commit
+    bool lsq = false;              // loads check older stores (forwarding, replay) instead of reading memory blindly
+    int storeset_entries = 0;      // store-set predictor size (with lsq), 0 = loads always speculate
+
+    MachineConfig()
+    {
+        for (int op = 0; op < NUM_OPCODES; ++op)
+        {
+            exec_latency[op] = OPCODES[op].exec_latency;
+            commit_latency[op] = OPCODES[op].commit_latency;
+        }
+        for (int f = 0; f < NUM_RS_FAMILIES; ++f)
+            rs_counts[f] = RS_COUNTS[f];
+    }
+};
+MachineConfig cfg; // from the command line; every Simulator runs on its own copy
 
 // ---------------- Data structures ----------------
+// Source operand role: a register read (reg >= 1) or a constant. R0 and
+// out-of-range register fields decode to constants, as the issue stage did.
+struct Operand
+{
+    int reg = -1;
+    int imm = 0;
+};
+
+// Instruction decoded once at load time; the pipeline only reads this
+struct MicroOp
+{
+    Op op = Op::NONE;
+    RSFamily family = RSFamily::COUNT;
+    ROBType rob_type = ROBType::NONE;
+    Operand j, k;        // RS operand roles (Vj/Qj and Vk/Qk)
+    int A = 0;           // LOAD/STORE offset
+    int dest = -1;       // ROB dest field at issue (REG: rd, CALL: R1)
+    bool writes_reg = false; // sets reg_tag[dest] at issue
+    int target = -1;     // BEQ: taken target, CALL: absolute target
+};
+
 struct Instr
 {
     int id;
@@ -68,14 +187,53 @@ struct Instr
     int rd;
     int rs1;
     int rs2_imm; // either rs2 or immediate depending on opcode
-    // timing
-    int issue = -1;
-    int exec_start = -1;
-    int exec_end = -1;
-    int write = -1;
-    int commit = -1;
-    int rob_idx = -1;
-    string text;
+    MicroOp uop;
+    string_view text; // points into Program::text_lines or the mapped image
+};
+
+// One committed dynamic instruction, as the report and traces show it
+struct CommitRecord
+{
+    long long seq;  // commit order
+    int prog_idx;   // static instruction (program index)
+    int addr;
+    long long issue, exec_start, exec_end, write, commit;
+};
+
+// Most recent commits, kept for the report. Older records are dropped so
+// memory stays flat however long the run is.
+struct CommitWindow
+{
+    vector<CommitRecord> buf;
+    size_t capacity = DEFAULT_HISTORY;
+    size_t next = 0; // ring position of the next record once full
+
+    void clear()
+    {
+        buf.clear();
+        next = 0;
+    }
+
+    void push(const CommitRecord& r)
+    {
+        if (capacity == 0)
+            return;
+        if (buf.size() < capacity)
+            buf.push_back(r);
+        else
+        {
+            buf[next] = r;
+            next = (next + 1) % capacity;
+        }
+    }
+
+    // oldest to newest
+    template <class F>
+    void for_each(F fn) const
+    {
+        for (size_t i = 0; i < buf.size(); ++i)
+            fn(buf[(next + i) % buf.size()]);
+    }
 };
 
 struct RS
@@ -86,8 +244,9 @@ struct RS
     int Vj = 0, Vk = 0;
     int Qj = -1, Qk = -1; // ROB tags that produce operands (-1 if ready)
     int A = 0;            // address/immediate
-    int exec_remaining = 0;
     bool exec_started = false;
+    bool exec_finished = false;
+    long long exec_done = -1; // cycle in which execution ends, once started
     int write_remaining = 1;
     int instr_id = -1;
     void clear() { *this = RS(); }
@@ -96,7 +255,7 @@ struct RS
 struct ROBEntry
 {
     bool busy = false;
-    string type;   // "REG", "STORE", "BR", "CALL", "RET"
+    ROBType type = ROBType::NONE;
     int dest = -1; // destination register (for REG) or memory address (for STORE)
     int value = 0;
     bool ready = false;
@@ -107,991 +266,6118 @@ struct ROBEntry
     void clear() { *this = ROBEntry(); }
 };
 
-// ---------------- Global state ----------------
-vector<Instr> program;              // list of instructions
-unordered_map<int, int> addr2index; // instruction address -> program index
-int startPC = 0;
-
-vector<int> regs(NUM_REG, 0);     // rf
-vector<int> reg_tag(NUM_REG, -1); // reg_stat    // map reg -> producing ROB index, -1 if none
-vector<int> memory_mem(MEM_SIZE, 0);
-
-vector<pair<string, vector<RS>>> RS_sets; // pair of family name and list of RS entries
-vector<string> RS_names_order;            // to find RS set by name
-
-// Execution history to report multiple executions of the same PC
-vector<Instr> committed_log;
-int exec_sequence = 0;
+// read-only view of a whole file: mmap where available, plain read otherwise.
+// copy() fills it from memory instead, for callers that load from buffers.
+struct MappedFile
+{
+    const char* data = nullptr;
+    size_t size = 0;
+    vector<char> buf; // contents when not mapped
 
-vector<ROBEntry> ROB(ROB_SIZE);
-int rob_head = 0, rob_tail = 0, rob_count = 0;
+    void copy(const char* p, size_t n)
+    {
+        close();
+        buf.assign(p, p + n);
+        data = buf.data();
+        size = n;
+    }
 
-int PC = 0; // current fetch address (instruction address)
-int cycle_num = 0;
+    bool open(const string& fname)
+    {
+        close();
+#ifdef _WIN32
+        ifstream f(fname, ios::binary);
+        if (!f)
+            return false;
+        buf.assign(istreambuf_iterator<char>(f), istreambuf_iterator<char>());
+        data = buf.data();
+        size = buf.size();
+        return true;
+#else
+        int fd = ::open(fname.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        size = (size_t)st.st_size;
+        if (size > 0)
+        {
+            void* m = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (m == MAP_FAILED)
+            {
+                ::close(fd);
+                size = 0;
+                return false;
+            }
+            data = (const char*)m;
+        }
+        ::close(fd); // the mapping stays valid
+        return true;
+#endif
+    }
 
-deque<int> fetch_queue; // program indices eligible to be issued in-order (by PC order)
+    void close()
+    {
+#ifndef _WIN32
+        if (data && data != buf.data())
+            munmap((void*)data, size);
+#endif
+        buf.clear();
+        data = nullptr;
+        size = 0;
+    }
 
-int cdb_used = 0;
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+};
 
-int total_instructions = 0;
-int branch_count = 0;
-int mispredictions = 0;
+// ---------------- Guest memory ----------------
+// Memory is split into 256-word pages of packed 16-bit words. A missing page
+// reads as zero, so a run only pays for the pages it actually touches.
+const int MEM_PAGE_BITS = 8;
+const int MEM_PAGE_WORDS = 1 << MEM_PAGE_BITS;
+const int MEM_PAGE_MASK = MEM_PAGE_WORDS - 1;
+const int MEM_PAGES = (MEM_SIZE + MEM_PAGE_WORDS - 1) / MEM_PAGE_WORDS;
 
-// ---------------- Helpers ----------------
-int wrap16(int x) { return (x & 0xFFFF); }
+const uint64_t FNV_OFFSET = 14695981039346656037ULL;
 
-int allocROB()
+uint64_t fnv1a(uint64_t h, const void* p, size_t n)
 {
-    if (rob_count == ROB_SIZE)
-        return -1;
-    int idx = rob_tail;
-    ROB[idx].busy = true;
-    ROB[idx].ready = false;
-    ROB[idx].value = 0;
-    ROB[idx].instr_id = -1;
-    ROB[idx].type = "";
-    ROB[idx].dest = -1;
-    ROB[idx].pc_on_issue = -1;
-    ROB[idx].br_target = -1;
-    ROB[idx].commit_remaining = 0;
-    rob_tail = (rob_tail + 1) % ROB_SIZE;
-    ++rob_count;
-    return idx;
+    const unsigned char* b = (const unsigned char*)p;
+    for (size_t i = 0; i < n; ++i)
+        h = (h ^ b[i]) * 1099511628211ULL;
+    return h;
 }
 
-void freeROB(int idx)
+// Read-only initial memory, shared by every simulation that starts from it.
+// Pages either point into a mapped binary image or are owned copies.
+struct MemoryImage
 {
-    ROB[idx].clear();
-    // commit handles head movement
-}
+    MappedFile file;
+    vector<unique_ptr<uint16_t[]>> owned;                             // pages not backed by the mapping
+    vector<const uint16_t*> pages = vector<const uint16_t*>(MEM_PAGES); // null = all-zero page
+    vector<int> present;                                              // sorted indices of non-null pages
+    uint64_t hash = FNV_OFFSET;                                       // contents, identifies the image in checkpoints
 
-// find RS set and an available RS for opcode
-bool find_free_rs_for_opcode(int opcode, int& rs_set_idx, int& rs_idx)
-{
-    string fam = opcodeRSFamily(opcode);
-    for (size_t i = 0; i < RS_sets.size(); ++i)
+    int at(int addr) const
+    {
+        const uint16_t* pg = pages[addr >> MEM_PAGE_BITS];
+        return pg ? pg[addr & MEM_PAGE_MASK] : 0;
+    }
+
+    // loaders only: owned, writable page (zero-filled on first use)
+    uint16_t* own_page(int page)
     {
-        if (RS_sets[i].first == fam)
+        if (!pages[page])
         {
-            for (size_t j = 0; j < RS_sets[i].second.size(); ++j)
-            {
-                if (!RS_sets[i].second[j].busy)
-                {
-                    rs_set_idx = (int)i;
-                    rs_idx = (int)j;
-                    return true;
-                }
-            }
+            owned.emplace_back(new uint16_t[MEM_PAGE_WORDS]());
+            pages[page] = owned.back().get();
         }
+        return const_cast<uint16_t*>(pages[page]);
     }
-    return false;
-}
 
-int find_rs_set_index_by_name(const string& name)
+    void finish_loading()
+    {
+        present.clear();
+        for (int p = 0; p < MEM_PAGES; ++p)
+            if (pages[p])
+                present.push_back(p);
+        hash = FNV_OFFSET;
+        for (int p : present)
+        {
+            hash = fnv1a(hash, &p, sizeof(p));
+            hash = fnv1a(hash, pages[p], MEM_PAGE_WORDS * sizeof(uint16_t));
+        }
+    }
+};
+
+// Per-simulation view of a MemoryImage: reads go to the shared base until a
+// page is first stored to, then that page is privately copied and marked
+// dirty. Reset and nonzero dumps only visit the dirty/present pages.
+struct GuestMemory
 {
-    for (size_t i = 0; i < RS_sets.size(); ++i)
-        if (RS_sets[i].first == name)
-            return (int)i;
-    return -1;
-}
+    shared_ptr<const MemoryImage> base;
+    vector<unique_ptr<uint16_t[]>> private_pages = vector<unique_ptr<uint16_t[]>>(MEM_PAGES);
+    vector<uint64_t> dirty_bits = vector<uint64_t>((MEM_PAGES + 63) / 64);
+    vector<int> dirty_list;                     // dirty page indices, in first-write order
+    vector<unique_ptr<uint16_t[]>> free_pages; // recycled by reset()
 
-void clear_all_rs_and_rob_younger_than_instr(int instr_pc) {
-    // clear RS entries whose instruction has pc > instr_pc
-    for (auto& p : RS_sets) {
-        for (auto& rs : p.second) {
-            if (rs.busy && rs.instr_id != -1) {
-                int pid = rs.instr_id;
-                if (program[pid].addr > instr_pc) {
-                    // Reset instruction timing fields
-                    program[pid].issue = -1;
-                    program[pid].exec_start = -1;
-                    program[pid].exec_end = -1;
-                    program[pid].write = -1;
-                    program[pid].commit = -1;
-                    program[pid].rob_idx = -1;
-                    rs.clear();
-                }
-            }
-        }
+    bool is_dirty(int page) const { return (dirty_bits[page >> 6] >> (page & 63)) & 1; }
+
+    int read(int addr) const
+    {
+        const auto& pg = private_pages[addr >> MEM_PAGE_BITS];
+        if (pg)
+            return pg[addr & MEM_PAGE_MASK];
+        return base ? base->at(addr) : 0;
     }
-    
-    // free ROB entries whose instruction pc > instr_pc
-    // We need to walk from head to tail and clear younger entries
-    int cleared_count = 0;
-    int new_tail = rob_head;
-    
-    for (int count = 0; count < rob_count; ++count) {
-        int idx = (rob_head + count) % ROB_SIZE;
-        
-        if (ROB[idx].busy && ROB[idx].instr_id != -1) {
-            int pid = ROB[idx].instr_id;
-            if (program[pid].addr > instr_pc) {
-                // This entry should be flushed
-                // Reset instruction timing fields
-                program[pid].issue = -1;
-                program[pid].exec_start = -1;
-                program[pid].exec_end = -1;
-                program[pid].write = -1;
-                program[pid].commit = -1;
-                program[pid].rob_idx = -1;
-                
-                if (ROB[idx].type == "REG" && ROB[idx].dest >= 0 && ROB[idx].dest < NUM_REG) {
-                    if (reg_tag[ROB[idx].dest] == idx) reg_tag[ROB[idx].dest] = -1;
-                }
-                if (ROB[idx].type == "CALL") {
-                    if (reg_tag[1] == idx) reg_tag[1] = -1;
-                }
-                ROB[idx].clear();
-                cleared_count++;
-            } else {
-                // This entry is older or equal, keep it
-                new_tail = (idx + 1) % ROB_SIZE;
+
+    void write(int addr, int val)
+    {
+        int page = addr >> MEM_PAGE_BITS;
+        auto& pg = private_pages[page];
+        if (!pg)
+        {
+            if (!free_pages.empty())
+            {
+                pg = move(free_pages.back());
+                free_pages.pop_back();
             }
+            else
+                pg.reset(new uint16_t[MEM_PAGE_WORDS]);
+            const uint16_t* src = base ? base->pages[page] : nullptr;
+            if (src)
+                memcpy(pg.get(), src, MEM_PAGE_WORDS * sizeof(uint16_t));
+            else
+                memset(pg.get(), 0, MEM_PAGE_WORDS * sizeof(uint16_t));
+            dirty_bits[page >> 6] |= 1ULL << (page & 63);
+            dirty_list.push_back(page);
         }
+        pg[addr & MEM_PAGE_MASK] = (uint16_t)val;
     }
-    
-    // Update ROB tail and count
-    rob_tail = new_tail;
-    rob_count -= cleared_count;
-    
-    // rebuild fetch queue starting at PC
-    fetch_queue.clear();
-    for (size_t i = 0; i < program.size(); ++i) {
-        if (program[i].addr >= PC) fetch_queue.push_back((int)i);
+
+    // current contents of a page, null if it is all zero
+    const uint16_t* page(int page) const
+    {
+        if (private_pages[page])
+            return private_pages[page].get();
+        return base ? base->pages[page] : nullptr;
     }
-}
 
-// ---------------- Parsing ----------------
-bool load_program_file(const string& fname)
-{
-    ifstream f(fname);
-    if (!f)
+    // checkpoint restore: replace a page's contents and mark it dirty
+    void restore_page(int page, const uint16_t* words)
     {
-        cerr << "Cannot open program file: " << fname << "\n";
-        return false;
+        write(page << MEM_PAGE_BITS, 0); // copies the page in and marks it dirty
+        memcpy(private_pages[page].get(), words, MEM_PAGE_WORDS * sizeof(uint16_t));
     }
-    string line;
-    vector<string> lines;
-    while (getline(f, line))
+
+    // start over from the base image: O(dirty pages)
+    void reset()
     {
-        // strip comments (# or //)
-        size_t p = line.find('#');
-        if (p != string::npos)
-            line = line.substr(0, p);
-        p = line.find("//");
-        if (p != string::npos)
-            line = line.substr(0, p);
-        // trim
-        auto trim = [](string s) -> string
-            {
-                size_t a = 0;
-                while (a < s.size() && isspace((unsigned char)s[a]))
-                    ++a;
-                size_t b = s.size();
-                while (b > a && isspace((unsigned char)s[b - 1]))
-                    --b;
-                return s.substr(a, b - a);
-            };
-        line = trim(line);
-        if (line.empty())
-            continue;
-        lines.push_back(line);
+        for (int page : dirty_list)
+        {
+            free_pages.push_back(move(private_pages[page]));
+            dirty_bits[page >> 6] = 0;
+        }
+        dirty_list.clear();
     }
-    if (lines.empty())
+
+    void attach(shared_ptr<const MemoryImage> img)
     {
-        cerr << "Empty program file\n";
-        return false;
+        base = move(img);
+        reset();
     }
-    // first non-empty line is starting address
-    startPC = stoi(lines[0]);
-    PC = startPC;
-    // remaining lines are instructions
-    program.clear();
-    addr2index.clear();
-    int idx = 0;
-    for (size_t i = 1; i < lines.size(); ++i)
+
+    // calls fn(addr, value) for every nonzero word in address order,
+    // visiting only pages that are dirty or present in the base
+    template <class F>
+    void for_each_nonzero(F fn) const
     {
-        istringstream iss(lines[i]);
-        int opcode, a, b, c;
-        if (!(iss >> opcode >> a >> b >> c))
+        vector<int> pages(dirty_list.begin(), dirty_list.end());
+        if (base)
+            pages.insert(pages.end(), base->present.begin(), base->present.end());
+        sort(pages.begin(), pages.end());
+        pages.erase(unique(pages.begin(), pages.end()), pages.end());
+        for (int page : pages)
         {
-            cerr << "Bad instruction format on line " << i + 1 << ": " << lines[i] << "\n";
-            return false;
+            const uint16_t* pg = private_pages[page] ? private_pages[page].get() : base->pages[page];
+            for (int i = 0; i < MEM_PAGE_WORDS; ++i)
+                if (pg[i] != 0)
+                    fn((page << MEM_PAGE_BITS) | i, (int)pg[i]);
         }
-        Instr ins;
-        ins.id = idx;
-        ins.addr = startPC + idx;
-        ins.opcode = opcode;
-        ins.rd = a;
-        ins.rs1 = b;
-        ins.rs2_imm = c;
-        ins.text = lines[i];
-        program.push_back(ins);
-        addr2index[ins.addr] = idx;
-        ++idx;
     }
-    total_instructions = (int)program.size();
-    return true;
+};
+
+// ---------------- Commit trace ----------------
+// Binary per-instruction timeline written from do_commit. The simulation
+// thread only copies a fixed-size record into a single-producer ring; a
+// background thread delta/varint-compresses blocks of records to disk.
+// File: TraceFileHeader, then blocks of { uint32 count, uint32 bytes, bytes }.
+// Each block is self-contained (delta state restarts at every block).
+const char TRACE_MAGIC[4] = { 'T', 'T', 'R', 'C' };
+const uint32_t TRACE_VERSION = 1;
+const size_t TRACE_RING_RECORDS = 1 << 16;
+const size_t TRACE_BLOCK_RECORDS = 4096;
+
+struct TraceRecord
+{
+    int64_t seq;
+    int32_t addr;
+    int32_t opcode;
+    int64_t issue, exec_start, exec_end, write, commit;
+};
+
+struct TraceFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t reserved;
+};
+
+void put_varint(string& out, int64_t v)
+{
+    uint64_t z = ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); // zigzag
+    while (z >= 0x80)
+    {
+        out.push_back((char)(z | 0x80));
+        z >>= 7;
+    }
+    out.push_back((char)z);
 }
 
-bool load_memory_file(const string& fname)
+bool get_varint(const char*& p, const char* end, int64_t& v)
 {
-    ifstream f(fname);
-    if (!f)
+    uint64_t z = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7)
     {
-        // not fatal: memory stays zero
-        return false;
+        uint8_t b = (uint8_t)*p++;
+        z |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80))
+        {
+            v = (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+            return true;
+        }
     }
-    string line;
-    while (getline(f, line))
+    return false;
+}
+
+// seq/addr/issue as deltas from the previous record, the other stages as
+// offsets from this record's issue cycle
+void encode_trace_block(const vector<TraceRecord>& recs, string& out)
+{
+    out.clear();
+    TraceRecord prev = {};
+    for (auto& r : recs)
     {
-        if (line.empty())
-            continue;
-        istringstream iss(line);
-        int addr, val;
-        if (!(iss >> addr >> val))
-            continue;
-        if (addr >= 0 && addr < MEM_SIZE)
-            memory_mem[addr] = wrap16(val);
+        put_varint(out, r.seq - prev.seq);
+        put_varint(out, r.addr - prev.addr);
+        put_varint(out, r.opcode);
+        put_varint(out, r.issue - prev.issue);
+        put_varint(out, r.exec_start - r.issue);
+        put_varint(out, r.exec_end - r.issue);
+        put_varint(out, r.write - r.issue);
+        put_varint(out, r.commit - r.issue);
+        prev = r;
     }
-    return true;
 }
 
-// ---------------- Initialization ----------------
-void init_structures()
+bool decode_trace_block(const char* p, const char* end, uint32_t count, vector<TraceRecord>& recs)
 {
-    // reset registers and tags
-    for (int i = 0; i < NUM_REG; ++i)
-        regs[i] = 0, reg_tag[i] = -1;
-    // R0 is always zero -- reg_tag irrelevant
+    recs.clear();
+    TraceRecord prev = {};
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        int64_t f[8];
+        for (auto& x : f)
+            if (!get_varint(p, end, x))
+                return false;
+        TraceRecord r;
+        r.seq = prev.seq + f[0];
+        r.addr = (int32_t)(prev.addr + f[1]);
+        r.opcode = (int32_t)f[2];
+        r.issue = prev.issue + f[3];
+        r.exec_start = r.issue + f[4];
+        r.exec_end = r.issue + f[5];
+        r.write = r.issue + f[6];
+        r.commit = r.issue + f[7];
+        recs.push_back(r);
+        prev = r;
+    }
+    return p == end;
+}
 
-    // build RS sets: we'll create families used by opcodeRSFamily
-    RS_sets.clear();
-    RS_names_order.clear();
-    // create entries for families with counts
-    unordered_map<string, int> mapCounts;
-    mapCounts["LOAD"] = 2;
-    mapCounts["STORE"] = 1;
-    mapCounts["BR"] = 2;
-    mapCounts["ADD"] = 4; // covers ADD/SUB
-    mapCounts["NAND"] = 2;
-    mapCounts["MUL"] = 1;
-    mapCounts["CALL"] = 1;
-    mapCounts["RET"] = 1;
-
-    for (auto& kv : mapCounts)
-    {
-        vector<RS> list;
-        for (int i = 0; i < kv.second; ++i)
-            list.push_back(RS());
-        RS_sets.push_back({ kv.first, list });
-        RS_names_order.push_back(kv.first);
+class TraceWriter
+{
+public:
+    bool open(const string& fname)
+    {
+        out.open(fname, ios::binary);
+        if (!out)
+            return false;
+        TraceFileHeader h;
+        memcpy(h.magic, TRACE_MAGIC, 4);
+        h.version = TRACE_VERSION;
+        h.record_size = sizeof(TraceRecord);
+        h.reserved = 0;
+        out.write((const char*)&h, sizeof(h));
+        ring.resize(TRACE_RING_RECORDS);
+        stop = false;
+        drainer = thread([this] { drain(); });
+        return true;
     }
-    // clear ROB
-    for (int i = 0; i < ROB_SIZE; ++i)
-        ROB[i].clear();
-    rob_head = rob_tail = rob_count = 0;
 
-    // build initial fetch queue starting from PC
-    fetch_queue.clear();
-    for (size_t i = 0; i < program.size(); ++i)
+    // simulation thread: never blocks unless the ring is full
+    void push(const TraceRecord& r)
     {
-        if (program[i].addr >= PC)
-            fetch_queue.push_back((int)i);
+        size_t t = tail.load(memory_order_relaxed);
+        while (t - head.load(memory_order_acquire) == ring.size())
+            this_thread::yield();
+        ring[t & (ring.size() - 1)] = r;
+        tail.store(t + 1, memory_order_release);
     }
 
-    cycle_num = 0;
-    cdb_used = 0;
-    branch_count = 0;
-    mispredictions = 0;
+    // flush everything and wait for the drain thread
+    bool close()
+    {
+        if (!drainer.joinable())
+            return true;
+        stop.store(true, memory_order_release);
+        drainer.join();
+        out.close();
+        return !failed;
+    }
 
-    committed_log.clear();
-    exec_sequence = 0;
-}
+    ~TraceWriter() { close(); }
 
-// ---------------- Pipeline stages ----------------
+private:
+    void drain()
+    {
+        vector<TraceRecord> block;
+        block.reserve(TRACE_BLOCK_RECORDS);
+        string packed;
+        for (;;)
+        {
+            bool stopping = stop.load(memory_order_acquire);
+            size_t h = head.load(memory_order_relaxed);
+            size_t t = tail.load(memory_order_acquire);
+            while (h != t && block.size() < TRACE_BLOCK_RECORDS)
+                block.push_back(ring[h++ & (ring.size() - 1)]);
+            head.store(h, memory_order_release);
+            if (block.size() == TRACE_BLOCK_RECORDS || (stopping && h == t && !block.empty()))
+            {
+                encode_trace_block(block, packed);
+                uint32_t hdr[2] = { (uint32_t)block.size(), (uint32_t)packed.size() };
+                out.write((const char*)hdr, sizeof(hdr));
+                out.write(packed.data(), packed.size());
+                failed |= !out;
+                block.clear();
+            }
+            else if (h == t)
+            {
+                if (stopping)
+                    return;
+                this_thread::sleep_for(chrono::microseconds(200));
+            }
+        }
+    }
+
+    vector<TraceRecord> ring;
+    atomic<size_t> head{ 0 }, tail{ 0 }; // consumer / producer positions
+    atomic<bool> stop{ false };
+    thread drainer;
+    ofstream out;
+    bool failed = false;
+};
 
-// Issue stage (single-issue)
-void do_issue()
+// ---------------- State blobs ----------------
+// Raw little helpers for checkpoints (see "Checkpoints"). Only trivially
+// copyable types go through them.
+struct BlobWriter
 {
-    if (fetch_queue.empty())
-        return;
-    int prog_idx = fetch_queue.front();
-    Instr& ins = program[prog_idx];
-    if (ins.addr != PC)
-        return; // must issue in-order by PC
-    
-    // If this instruction executed before, reset its timing for a fresh run
-    if (ins.issue != -1 || ins.exec_start != -1 || ins.exec_end != -1 || ins.write != -1 || ins.commit != -1)
+    string& out;
+
+    template <class T>
+    void pod(const T& v) { out.append((const char*)&v, sizeof(T)); }
+
+    template <class T>
+    void vec(const vector<T>& v)
     {
-        ins.issue = -1;
-        ins.exec_start = -1;
-        ins.exec_end = -1;
-        ins.write = -1;
-        ins.commit = -1;
-        ins.rob_idx = -1;
+        pod((uint64_t)v.size());
+        out.append((const char*)v.data(), v.size() * sizeof(T));
     }
-    Instr& current_ins = ins;
-    
-    // check ROB free slot
-    int rob_idx = allocROB();
-    if (rob_idx == -1)
+};
+
+struct BlobReader
+{
+    const char* p;
+    const char* end;
+
+    template <class T>
+    bool pod(T& v)
+    {
+        if ((size_t)(end - p) < sizeof(T))
+            return false;
+        memcpy(&v, p, sizeof(T));
+        p += sizeof(T);
+        return true;
+    }
+
+    template <class T>
+    bool vec(vector<T>& v)
+    {
+        uint64_t n;
+        if (!pod(n) || n > (uint64_t)(end - p) / sizeof(T))
+            return false;
+        v.resize((size_t)n);
+        if (n)
+            memcpy((void*)v.data(), p, (size_t)n * sizeof(T)); // T is trivially copyable
+        p += n * sizeof(T);
+        return true;
+    }
+
+    // into an existing vector, which must already have the stored size
+    template <class T>
+    bool vec_exact(vector<T>& v)
+    {
+        vector<T> tmp;
+        if (!vec(tmp) || tmp.size() != v.size())
+            return false;
+        v.swap(tmp);
+        return true;
+    }
+};
+
+// ---------------- Branch prediction ----------------
+// Direction predictors, consulted at issue. The global history lives in the
+// Simulator and the history at prediction time is saved with each branch, so
+// predict/update depend only on (pc, history, tables) and recovering from a
+// squash means restoring a single register.
+struct BranchPredictor
+{
+    virtual ~BranchPredictor() {}
+    virtual bool predict(int pc, uint64_t hist) const = 0; // true = taken
+    virtual void update(int pc, uint64_t hist, bool taken) = 0;
+    virtual void save(BlobWriter& w) const = 0;
+    virtual bool load(BlobReader& r) = 0;
+};
+
+struct NotTakenPredictor : BranchPredictor
+{
+    bool predict(int, uint64_t) const override { return false; }
+    void update(int, uint64_t, bool) override {}
+    void save(BlobWriter&) const override {}
+    bool load(BlobReader&) override { return true; }
+};
+
+// 2-bit saturating counter, taken when >= 2
+void train2(uint8_t& c, bool taken)
+{
+    if (taken)
+        c += c < 3;
+    else
+        c -= c > 0;
+}
+
+// per-PC 2-bit counters
+struct BimodalPredictor : BranchPredictor
+{
+    vector<uint8_t> ctr;
+
+    explicit BimodalPredictor(int entries) : ctr(entries, 1) {}
+    size_t index(int pc) const { return (size_t)pc & (ctr.size() - 1); }
+    bool predict(int pc, uint64_t) const override { return ctr[index(pc)] >= 2; }
+    void update(int pc, uint64_t, bool taken) override { train2(ctr[index(pc)], taken); }
+    void save(BlobWriter& w) const override { w.vec(ctr); }
+    bool load(BlobReader& r) override { return r.vec_exact(ctr); }
+};
+
+// 2-bit counters indexed by PC xor global history
+struct GsharePredictor : BranchPredictor
+{
+    vector<uint8_t> ctr;
+
+    explicit GsharePredictor(int entries) : ctr(entries, 1) {}
+    size_t index(int pc, uint64_t hist) const { return ((uint64_t)pc ^ hist) & (ctr.size() - 1); }
+    bool predict(int pc, uint64_t hist) const override { return ctr[index(pc, hist)] >= 2; }
+    void update(int pc, uint64_t hist, bool taken) override { train2(ctr[index(pc, hist)], taken); }
+    void save(BlobWriter& w) const override { w.vec(ctr); }
+    bool load(BlobReader& r) override { return r.vec_exact(ctr); }
+};
+
+// TAGE-lite: a bimodal base plus four tagged tables indexed with geometric
+// history lengths. The longest matching table provides the prediction; a
+// misprediction allocates an entry in a longer table whose useful counter
+// has run down.
+struct TagePredictor : BranchPredictor
+{
+    static const int TABLES = 4;
+    static constexpr int HIST_LEN[TABLES] = { 4, 8, 16, 32 };
+    struct Entry
+    {
+        int8_t ctr = 0;   // 3-bit signed, taken when >= 0
+        uint8_t u = 0;    // 2-bit useful counter
+        uint16_t tag = 0; // 0 = empty
+    };
+    vector<uint8_t> base;
+    vector<Entry> tables[TABLES];
+    int bits; // log2 of the entries per tagged table
+
+    explicit TagePredictor(int entries) : base(entries, 1)
+    {
+        bits = 0;
+        while ((2 << bits) <= entries / 4)
+            ++bits;
+        for (auto& t : tables)
+            t.assign((size_t)1 << bits, Entry());
+    }
+
+    static uint64_t fold(uint64_t h, int len, int width)
+    {
+        h &= (1ULL << len) - 1;
+        uint64_t f = 0;
+        for (; h; h >>= width)
+            f ^= h & ((1ULL << width) - 1);
+        return f;
+    }
+    size_t index(int t, int pc, uint64_t hist) const { return ((uint64_t)pc ^ ((uint64_t)pc >> bits) ^ fold(hist, HIST_LEN[t], bits)) & ((1ULL << bits) - 1); }
+    uint16_t tag(int t, int pc, uint64_t hist) const { return (uint16_t)((((uint64_t)pc ^ fold(hist, HIST_LEN[t], 8) ^ (fold(hist, HIST_LEN[t], 7) << 1)) & 0xFF) + 1); }
+    bool base_predict(int pc) const { return base[(size_t)pc & (base.size() - 1)] >= 2; }
+
+    // longest matching table (-1 = base) and the next longest
+    int provider(int pc, uint64_t hist, int& alt) const
+    {
+        int p = alt = -1;
+        for (int t = TABLES - 1; t >= 0; --t)
+            if (tables[t][index(t, pc, hist)].tag == tag(t, pc, hist))
+            {
+                if (p == -1)
+                    p = t;
+                else if (alt == -1)
+                    alt = t;
+            }
+        return p;
+    }
+    bool table_predict(int t, int pc, uint64_t hist) const { return t < 0 ? base_predict(pc) : tables[t][index(t, pc, hist)].ctr >= 0; }
+
+    bool predict(int pc, uint64_t hist) const override
+    {
+        int alt;
+        return table_predict(provider(pc, hist, alt), pc, hist);
+    }
+
+    void update(int pc, uint64_t hist, bool taken) override
+    {
+        int alt;
+        int p = provider(pc, hist, alt);
+        bool pred = table_predict(p, pc, hist);
+        if (p >= 0)
+        {
+            Entry& e = tables[p][index(p, pc, hist)];
+            if (pred != table_predict(alt, pc, hist))
+                e.u = pred == taken ? min(e.u + 1, 3) : max(e.u - 1, 0);
+            e.ctr = (int8_t)(taken ? min(e.ctr + 1, 3) : max(e.ctr - 1, -4));
+        }
+        else
+            train2(base[(size_t)pc & (base.size() - 1)], taken);
+        if (pred == taken)
+            return;
+        bool allocated = false;
+        for (int t = p + 1; t < TABLES && !allocated; ++t)
+        {
+            Entry& e = tables[t][index(t, pc, hist)];
+            if (e.u == 0)
+            {
+                e.tag = tag(t, pc, hist);
+                e.ctr = taken ? 0 : -1;
+                allocated = true;
+            }
+        }
+        for (int t = p + 1; t < TABLES && !allocated; ++t)
+        {
+            Entry& e = tables[t][index(t, pc, hist)];
+            e.u -= e.u > 0;
+        }
+    }
+
+    void save(BlobWriter& w) const override
+    {
+        w.vec(base);
+        for (auto& t : tables)
+            w.vec(t);
+    }
+    bool load(BlobReader& r) override
+    {
+        bool ok = r.vec_exact(base);
+        for (auto& t : tables)
+            ok = ok && r.vec_exact(t);
+        return ok;
+    }
+};
+
+unique_ptr<BranchPredictor> make_predictor(BPKind kind, int entries)
+{
+    switch (kind)
+    {
+    case BPKind::BIMODAL:
+        return make_unique<BimodalPredictor>(entries);
+    case BPKind::GSHARE:
+        return make_unique<GsharePredictor>(entries);
+    case BPKind::TAGE:
+        return make_unique<TagePredictor>(entries);
+    default:
+        return make_unique<NotTakenPredictor>();
+    }
+}
+
+// Direct-mapped branch target buffer. A branch is only redirected at issue
+// when the BTB knows its target; taken branches fill it at commit.
+struct BTB
+{
+    vector<int> pc; // -1 = empty
+    vector<int> target;
+
+    void reset(int entries)
+    {
+        pc.assign(entries, -1);
+        target.assign(entries, 0);
+    }
+    bool lookup(int addr, int& tgt) const
+    {
+        size_t i = (size_t)addr & (pc.size() - 1);
+        if (pc[i] != addr)
+            return false;
+        tgt = target[i];
+        return true;
+    }
+    void insert(int addr, int tgt)
+    {
+        size_t i = (size_t)addr & (pc.size() - 1);
+        pc[i] = addr;
+        target[i] = tgt;
+    }
+};
+
+// Return address stack: pushed at CALL issue, popped at RET issue. When it
+// is full a push overwrites the oldest entry.
+struct RAS
+{
+    vector<int> addr;
+    int top = 0;   // slot the next push goes to
+    int count = 0; // valid entries
+
+    void reset(int entries)
+    {
+        addr.assign(entries, 0);
+        top = count = 0;
+    }
+    int size() const { return (int)addr.size(); }
+    void push(int a)
+    {
+        addr[top] = a;
+        top = top + 1 == size() ? 0 : top + 1;
+        count = min(count + 1, size());
+    }
+    bool pop(int& a)
+    {
+        if (count == 0)
+            return false;
+        top = (top == 0 ? size() : top) - 1;
+        --count;
+        a = addr[top];
+        return true;
+    }
+};
+
+// Prediction made for an in-flight branch or RET, per ROB slot. A LOAD
+// keeps its hist and RAS copy too, for a replay (see "Load/store queue").
+struct BranchInfo
+{
+    bool predicted = false;    // predicted taken (and redirected at issue)
+    bool resolved = false;     // outcome checked (at write or commit, see bp.resolve)
+    bool mispredicted = false;
+    uint64_t hist = 0;         // global history before this branch
+    int target = -1;           // RET: predicted return address
+    int ras_top = 0;           // RAS pointers after this instruction issued; the
+    int ras_count = 0;         // entries themselves are in Simulator::ras_snap
+};
+
+// ---------------- Load/store queue ----------------
+// In-flight LOADs and STOREs in program order (Simulator::lsq_order), with
+// per-ROB-slot state. A store's address is known when it finishes executing
+// and its data when it writes. With cfg.lsq a load takes its value, when it
+// writes, from the youngest older store to the same address, or from memory
+// if there is none; it does not wait for older stores whose address is still
+// unknown. When such a store resolves to the address of a load that already
+// read an older value, the load and everything after it are squashed and
+// fetched again (a replay).
+struct LSQEntry
+{
+    bool addr_ready = false; // STORE: address computed; LOAD: value read
+    int addr = -1;
+    long long source = -1;   // LOAD: seq of the store it forwarded from, -1 = memory
+    int wait_rob = -1;       // LOAD: store predicted to alias it (store sets), -1 = none
+    long long wait_seq = -1;
+};
+
+// Store-set memory dependence predictor (Chrysos and Emer). A load and a
+// store that caused a replay are put in the same set; later instances of
+// the load wait for the address of the last store fetched from that set.
+struct StoreSets
+{
+    vector<int> ssit;                  // PC -> set id, -1 = none
+    vector<pair<int, long long>> lfst; // set id -> (ROB slot, seq) of its last fetched store
+
+    void reset(int entries)
+    {
+        ssit.assign(entries, -1);
+        lfst.assign(entries, { -1, -1 });
+    }
+    bool enabled() const { return !ssit.empty(); }
+    int& set_of(int pc) { return ssit[(size_t)pc & (ssit.size() - 1)]; }
+    void train(int load_pc, int store_pc)
+    {
+        int& l = set_of(load_pc);
+        int& st = set_of(store_pc);
+        if (l == -1 && st == -1)
+            l = st = (int)((size_t)store_pc & (ssit.size() - 1));
+        else if (l == -1)
+            l = st;
+        else if (st == -1)
+            st = l;
+        else
+            l = st = min(l, st);
+    }
+};
+
+// ---------------- Stall accounting ----------------
+// Every cycle is charged to one cause, seen from the ROB head: "commit" if
+// something committed, otherwise what kept the head from committing. The
+// cycles between two commits all belong to the instruction that commits
+// second, which was the oldest in flight (or not fetched yet) throughout, so
+// they are split up by its timestamps when it commits instead of cycle by
+// cycle. Every issue slot is charged from the issue stage. Both are kept per
+// RS family (of the head, or of the instruction at fetch); the extra last
+// row is for cycles and slots without one (empty ROB, HALT, nothing to fetch).
+enum class CycleCause : uint8_t
+{
+    COMMIT,      // at least one instruction committed
+    OPERANDS,    // head waiting for an operand (a STORE for its data, a LOAD for an older STORE)
+    EXECUTE,     // head executing, or in its write cycle
+    CDB,         // head ready to write but every CDB went to an older result
+    COMMIT_WAIT, // head written, counting down its commit latency
+    RECOVERY,    // refilling after a squash, until the first refetched instruction commits
+    FRONT_END,   // ROB empty: nothing fetched
+    COUNT
+};
+const int NUM_CYCLE_CAUSES = (int)CycleCause::COUNT;
+constexpr const char* CYCLE_CAUSE_NAMES[NUM_CYCLE_CAUSES] = { "commit", "operands", "execute", "cdb", "commit-wait", "recovery", "front-end" };
+
+enum class SlotUse : uint8_t
+{
+    ISSUED,     // issued and committed (or still in flight)
+    SQUASHED,   // issued on a wrong path, or before a replayed load
+    ROB_FULL,   // allocROB failed
+    RS_FULL,    // no free RS in the instruction's family
+    FETCH_IDLE, // HALT issued, draining, or PC outside the program
+    COUNT
+};
+const int NUM_SLOT_USES = (int)SlotUse::COUNT;
+constexpr const char* SLOT_USE_NAMES[NUM_SLOT_USES] = { "issued", "squashed", "rob-full", "rs-full", "fetch-idle" };
+
+struct StallCounters
+{
+    long long cycles[NUM_RS_FAMILIES + 1][NUM_CYCLE_CAUSES] = {};
+    long long slots[NUM_RS_FAMILIES + 1][NUM_SLOT_USES] = {};
+
+    void cycle(int family, CycleCause c, long long n = 1) { cycles[family][(int)c] += n; }
+    void slot(int family, SlotUse u, long long n = 1) { slots[family][(int)u] += n; }
+};
+
+// ---------------- Self-profiling ----------------
+// --profile times the simulator itself: host time per simulated cycle and per
+// committed instruction, and how it splits over the pipeline stages. The
+// stage probes read the host cycle counter (the TSC on x86, steady_clock
+// elsewhere) in a random one step out of PROFILE_SAMPLE_PERIOD on average,
+// so that a loop whose length divides the period cannot bias them. Reading
+// the counter between stages stops them from overlapping, so a timed step
+// runs slower than an untimed one; the report gives each stage's share of
+// the timed steps and applies it to the measured host time. Building with
+// -DTOMASULO_NO_PROFILE compiles the probes out; --profile then reports the
+// throughput alone.
+#ifdef TOMASULO_NO_PROFILE
+const bool PROFILE_PROBES = false;
+#else
+const bool PROFILE_PROBES = true;
+#endif
+const int PROFILE_SAMPLE_PERIOD = 16; // a power of two
+const uint64_t PROFILE_MAX_INTERVAL = 1 << 20; // ticks
+
+enum class HostStage : uint8_t
+{
+    EXECUTE,     // do_execute
+    WRITE,       // do_write, less the flushes it starts
+    COMMIT,      // do_commit, less the flushes it starts
+    ISSUE,       // do_issue, all issue_width attempts
+    FLUSH,       // squash_after, wherever it is called from
+    TERMINATION, // all_committed()
+    COUNT
+};
+const int NUM_HOST_STAGES = (int)HostStage::COUNT;
+constexpr const char* HOST_STAGE_NAMES[NUM_HOST_STAGES] = { "do_execute", "do_write", "do_commit", "do_issue", "flush", "all_committed" };
+
+inline uint64_t host_ticks()
+{
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+    return __rdtsc();
+#else
+    return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Whole-run hardware counters through Linux perf_event. Any counter the
+// kernel or the machine does not offer is left out.
+struct PerfCounters
+{
+    static const int N = 4;
+    static constexpr const char* NAMES[N] = { "cycles", "instructions", "cache-misses", "branch-misses" };
+    int fd[N] = { -1, -1, -1, -1 };
+    long long value[N] = {};
+    string error; // why none could be opened
+
+    PerfCounters() = default;
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+    ~PerfCounters()
+    {
+#ifdef __linux__
+        for (int f : fd)
+            if (f != -1)
+                close(f);
+#endif
+    }
+
+    bool any() const { return *max_element(fd, fd + N) != -1; }
+
+    void start()
+    {
+#ifdef __linux__
+        const uint64_t events[N] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+        for (int i = 0; i < N; ++i)
+        {
+            perf_event_attr a;
+            memset(&a, 0, sizeof(a));
+            a.type = PERF_TYPE_HARDWARE;
+            a.size = sizeof(a);
+            a.config = events[i];
+            a.disabled = 1;
+            a.exclude_kernel = 1;
+            a.exclude_hv = 1;
+            fd[i] = (int)syscall(SYS_perf_event_open, &a, 0, -1, -1, 0); // this thread, any CPU
+            if (fd[i] == -1 && error.empty())
+                error = string("perf_event_open: ") + strerror(errno);
+        }
+        for (int f : fd)
+            if (f != -1)
+            {
+                ioctl(f, PERF_EVENT_IOC_RESET, 0);
+                ioctl(f, PERF_EVENT_IOC_ENABLE, 0);
+            }
+#else
+        error = "needs Linux perf_event";
+#endif
+    }
+
+    void stop()
+    {
+#ifdef __linux__
+        for (int i = 0; i < N; ++i)
+            if (fd[i] != -1)
+            {
+                ioctl(fd[i], PERF_EVENT_IOC_DISABLE, 0);
+                if (read(fd[i], &value[i], sizeof(value[i])) != (ssize_t)sizeof(value[i]))
+                {
+                    close(fd[i]);
+                    fd[i] = -1;
+                }
+            }
+#endif
+    }
+};
+
+struct HostProfile
+{
+    uint64_t ticks[NUM_HOST_STAGES] = {}; // in the sampled steps only
+    long long sampled_steps = 0;
+    uint32_t rng = 2463534242u; // xorshift32 state for picking the sampled steps
+    int stage = -1;          // stage being timed, -1 outside a sampled step
+    uint64_t mark = 0;       // host_ticks() when it started
+    uint64_t probe_cost = 0; // ticks one probe adds to the stage it ends
+
+    // the whole run
+    chrono::steady_clock::time_point wall_start, wall_stop;
+    long long cycles_start = 0, cycles_stop = 0;
+    long long committed_start = 0, committed_stop = 0;
+    PerfCounters perf;
+
+    void start(long long cycles, long long committed)
+    {
+        uint64_t best = UINT64_MAX;
+        for (int i = 0; i < 1000; ++i)
+        {
+            uint64_t a = host_ticks();
+            best = min(best, host_ticks() - a);
+        }
+        probe_cost = best;
+        cycles_start = cycles;
+        committed_start = committed;
+        perf.start();
+        wall_start = chrono::steady_clock::now();
+    }
+
+    void stop(long long cycles, long long committed)
+    {
+        wall_stop = chrono::steady_clock::now();
+        perf.stop();
+        cycles_stop = cycles;
+        committed_stop = committed;
+    }
+
+    // whether this step is one of the timed ones
+    bool sample()
+    {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        if ((rng & (PROFILE_SAMPLE_PERIOD - 1)) != 0)
+            return false;
+        ++sampled_steps;
+        return true;
+    }
+
+    // charge the ticks since the last switch to the current stage and time s
+    // from now on (-1: stop timing). Returns the stage that was running.
+    int switch_to(int s)
+    {
+        uint64_t now = host_ticks();
+        if (stage >= 0 && now - mark < PROFILE_MAX_INTERVAL) // longer: the thread was descheduled
+            ticks[stage] += max(now - mark, probe_cost) - probe_cost;
+        int prev = stage;
+        stage = s;
+        mark = now;
+        return prev;
+    }
+};
+
+// ---------------- Simulator state ----------------
+// Decoded program, loaded once and shared read-only by every simulator
+// instance that runs it
+struct Program
+{
+    vector<Instr> instrs;
+    int start_pc = 0;
+    int num_reg = MachineConfig().num_reg; // set before loading: operands are decoded for it
+    vector<string> text_lines; // backing storage for Instr::text (text loader)
+    MappedFile image;          // backing storage for Instr::text (program image)
+};
+
+// Timing of one dynamic instruction, kept in its ROB slot while in flight
+struct InstrTiming
+{
+    long long issue = -1;
+    long long exec_start = -1;
+    long long exec_end = -1;
+    long long write = -1;
+    long long commit = -1;
+    long long seq = -1; // dynamic instance number, in issue order
+    long long cdb_ready = -1; // first cycle the result could have had a CDB, -1 once it had one
+    long long cdb_lost = 0;   // cycles from then until it got one
+};
+
+struct CheckpointHeader;
+uint64_t program_hash(const Program& prog);
+
+// Sampled runs (--sample): instruction counts of each phase in a period
+struct SamplingOptions
+{
+    long long fast_forward = 0;
+    long long warmup = 0;
+    long long detail = 0;
+};
+
+struct SampleReport
+{
+    vector<double> cpi; // one per measured window
+    long long instructions = 0;
+    long long detailed_instructions = 0;
+    long long detailed_cycles = 0;
+};
+
+// One independent simulator. Everything a run mutates lives here; the
+// Program and the base MemoryImage are only read, so instances can share
+// them across threads.
+struct Simulator
+{
+    MachineConfig cfg;
+    shared_ptr<const Program> prog;
+    const vector<Instr>& program; // list of instructions (prog->instrs)
+    int startPC = 0;
+    vector<InstrTiming> timing; // per ROB slot
+
+    // Termination bookkeeping per program index: whether the latest execution
+    // has committed, and which dynamic instance that is
+    vector<uint8_t> latest_committed;
+    vector<long long> latest_seq;
+    long long next_seq = 0;
+
+    vector<int> regs;    // rf, cfg.num_reg entries
+    vector<int> reg_tag; // reg_stat    // map reg -> producing ROB index, -1 if none
+    GuestMemory memory_mem; // copy-on-write over the shared memory image
+
+    vector<vector<RS>> RS_sets; // RS entries per family, indexed by RSFamily
+
+    // Wakeup/select structures. RS entries are addressed by a flat slot number,
+    // family by family in RS_sets order.
+    vector<RS*> rs_by_slot;
+    vector<int> rs_slot_base;        // first slot of each family
+    vector<vector<int>> rob_waiters; // ROB tag -> slots waiting on it
+    vector<int> start_queue;         // slots woken since the last execute stage
+    priority_queue<pair<long long, int>, vector<pair<long long, int>>, greater<pair<long long, int>>> exec_done_queue; // (end cycle, slot)
+    set<pair<long long, int>> write_ready; // (timing seq, slot), oldest first
+
+    // Squash recovery, per ROB slot. The ROB is in age order, so the entries
+    // younger than a mispredicted one are just the slots after it up to the
+    // tail; these let a squash undo each of them without scanning the RS
+    // or rebuilding the rename map.
+    vector<int> rob_rs_slot; // RS slot taken at issue, -1 for none (HALT)
+    vector<int> rename_undo; // reg_tag[dest] it replaced
+
+    // Execution history to report multiple executions of the same PC
+    CommitWindow committed_log;
+    long long committed_count = 0; // all committed executions, including ones dropped from the window
+    unique_ptr<TraceWriter> trace_out; // --trace sink, null when not tracing
+
+    vector<ROBEntry> ROB; // cfg.rob_size entries
+    int rob_head = 0, rob_tail = 0, rob_count = 0;
+
+    int PC = 0; // current fetch address (instruction address)
+    long long cycle_num = 0;
+    bool fetch_halted = false; // HALT issued: no fetch until a redirect
+    bool draining = false;     // drain(): no fetch until the ROB is empty
+
+    // Termination, all checked in O(1) per cycle
+    long long uncommitted_instrs = 0; // static instructions whose latest execution has not committed (latest_committed == 0)
+    bool halted = false;              // HALT committed or the halt PC was reached
+    int halted_at = -1;               // address of the HALT, or the sentinel reached
+    int halt_pc = -1;                 // --halt-pc sentinel, -1 if unused
+
+    int cdb_used = 0;
+    bool event_driven = false; // skip idle cycles instead of stepping through them
+
+    long long branch_count = 0;
+    long long mispredictions = 0;
+    long long fast_forwarded = 0; // instructions run by fast_forward()
+
+    // Branch prediction (cfg.bp)
+    unique_ptr<BranchPredictor> predictor;
+    BTB btb;
+    uint64_t ghr = 0;               // speculative global history, newest outcome in bit 0
+    vector<BranchInfo> branch_info; // per ROB slot
+    // bp.compare: every predictor kind, run over the committed branches in order
+    vector<unique_ptr<BranchPredictor>> shadow;
+    vector<long long> shadow_misses;
+    uint64_t shadow_ghr = 0;
+    long long committed_branches = 0;
+    // Return address stack (cfg.ras_entries > 0). Branches and RETs keep a copy
+    // of the stack as it was after they issued, so a squash can put it back.
+    RAS ras;
+    vector<int> ras_snap; // cfg.ras_entries words per ROB slot
+    long long ras_hits = 0;
+    long long ras_misses = 0;
+
+    // Load/store queue (kept up to date always, used with cfg.lsq)
+    vector<LSQEntry> lsq; // per ROB slot
+    deque<int> lsq_order; // ROB slots of in-flight LOADs and STOREs, oldest first
+    StoreSets store_sets;
+    long long lsq_loads = 0;     // committed loads
+    long long lsq_forwarded = 0; // ... that took their value from a store
+    long long lsq_replays = 0;
+    long long lsq_waits = 0;     // loads issued with a predicted dependence
+
+    // Stall accounting (always on)
+    StallCounters stalls;
+    long long recovery_seq = -1;  // seq of the first instruction fetched after the last squash, until it commits
+    long long last_commit_cycle = 0;
+
+    unique_ptr<HostProfile> profile; // --profile, null when off
+
+    bool (Simulator::*step_fn)() = nullptr; // pipeline picked by select_step()
+    uint64_t prog_hash = 0;                 // identifies the program in checkpoints
+
+    Simulator(const MachineConfig& config, shared_ptr<const Program> p, shared_ptr<const MemoryImage> mem);
+    Simulator(const Simulator&) = delete;
+    Simulator& operator=(const Simulator&) = delete;
+
+    // Run control
+    void init_structures(); // reset to cycle 0 (memory is left as is)
+    bool step() { return (this->*step_fn)(); }
+    bool all_committed() const { return uncommitted_instrs == 0; }
+    long long skip_idle_cycles(long long max_skip);
+    long long run(long long max_cycles, long long max_commits);
+    void print_report() const;
+    void print_cpi_stack() const;
+    void start_profile();
+    void stop_profile();
+    void print_profile() const;
+
+    // Functional fast-forward and sampling
+    template <class F> long long interpret(long long n, F&& on_instr);
+    long long fast_forward(long long n);
+    long long drain();
+    bool finished() const; // halted, or nothing left that can run
+    SampleReport run_sampled(const SamplingOptions& o, long long max_cycles, long long max_instrs);
+
+    // Checkpoints
+    CheckpointHeader checkpoint_header() const;
+    uint64_t predictor_setup() const;
+    void save_checkpoint(string& out) const;
+    bool restore_checkpoint(const char* data, size_t size);
+    bool save_checkpoint_file(const string& fname) const;
+    bool restore_checkpoint_file(const string& fname);
+
+    // Helpers
+    int fetch_index() const;
+    void redirect_fetch(int target);
+    void clear_timing();
+    // Pipeline code is instantiated on the ROB size R and issue width W. R/W > 0
+    // are the fast paths (see FAST_PATHS); 0 reads the value from cfg.
+    template <int R> int rob_size() const { return R > 0 ? R : cfg.rob_size; }
+    template <int W> int issue_width() const { return W > 0 ? W : cfg.issue_width; }
+    template <int R> int rob_next(int i) const { return i + 1 == rob_size<R>() ? 0 : i + 1; }
+    template <int R> int rob_prev(int i) const { return (i == 0 ? rob_size<R>() : i) - 1; }
+    template <int R> int allocROB();
+    void freeROB(int idx);
+    bool find_free_rs_for_opcode(int opcode, int& rs_set_idx, int& rs_idx) const;
+    void wakeup(int tag);
+    template <int R> void squash_after(int rob_idx);
+    template <int R> void resolve_branch(int rob_idx);
+    template <int R> void resolve_return(int rob_idx);
+    void save_ras(int rob_idx);
+    void restore_ras(int rob_idx);
+    void lsq_issue(int rob_idx, const Instr& ins);
+    void store_address_ready(int rob_idx, int addr);
+    int older_store(int load_idx, int addr) const;
+    bool load_blocked(const RS& rs) const;
+    int load_value(int rob_idx, int addr);
+    void replay_load(int rob_idx);
+    void rebuild_squash_links();
+    void count_stall_cycles(StallCounters& out, int rob_idx, long long from, long long to) const;
+    void count_issue_stall(long long slots);
+
+    // Pipeline stages
+    void select_step();
+    template <int R> void do_issue();
+    void do_execute();
+    int oldest_write_ready(pair<long long, int> after = { -1, -1 });
+    void do_write();
+    void write_result(RS& rs);
+    template <int R> void do_commit();
+    template <int R> bool commit_head();
+    long long commit_ready_at(int rob_idx) const;
+    template <int R, int W, bool P = false> bool step_impl(); // P: the --profile pipeline
+    long long next_event_cycle();
+};
+
+// ---------------- Helpers ----------------
+int wrap16(int x) { return (x & 0xFFFF); }
+
+// s as a JSON string literal
+string json_quoted(const string& s)
+{
+    string q = "\"";
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+        {
+            q += '\\';
+            q += c;
+        }
+        else if (c == '\n')
+            q += "\\n";
+        else if (c == '\t')
+            q += "\\t";
+        else if ((unsigned char)c < 0x20)
+        {
+            char esc[8];
+            snprintf(esc, sizeof esc, "\\u%04x", (unsigned char)c);
+            q += esc;
+        }
+        else
+            q += c;
+    }
+    return q + "\"";
+}
+
+// s as a CSV field: quoted, with embedded quotes doubled
+string csv_quoted(const string& s)
+{
+    string q = "\"";
+    for (char c : s)
+        q += (c == '"') ? string("\"\"") : string(1, c);
+    return q + "\"";
+}
+
+// Fetch: program is dense (addr == startPC + index), so the instruction at PC
+// is a bounds check away and a redirect is just a new PC
+int Simulator::fetch_index() const
+{
+    int idx = PC - startPC;
+    return (idx >= 0 && idx < (int)program.size()) ? idx : -1;
+}
+
+void Simulator::redirect_fetch(int target)
+{
+    PC = target;
+    fetch_halted = false;
+}
+
+// every instruction starts out uncommitted
+void Simulator::clear_timing()
+{
+    timing.assign(cfg.rob_size, InstrTiming());
+    latest_committed.assign(program.size(), 0);
+    latest_seq.assign(program.size(), -1);
+    uncommitted_instrs = (long long)program.size();
+}
+
+template <int R>
+int Simulator::allocROB()
+{
+    if (rob_count == rob_size<R>())
+        return -1;
+    int idx = rob_tail;
+    ROB[idx].busy = true;
+    ROB[idx].ready = false;
+    ROB[idx].value = 0;
+    ROB[idx].instr_id = -1;
+    ROB[idx].type = ROBType::NONE;
+    ROB[idx].dest = -1;
+    ROB[idx].pc_on_issue = -1;
+    ROB[idx].br_target = -1;
+    ROB[idx].commit_remaining = 0;
+    rob_waiters[idx].clear();
+    rob_tail = rob_next<R>(rob_tail);
+    ++rob_count;
+    return idx;
+}
+
+void Simulator::freeROB(int idx)
+{
+    ROB[idx].clear();
+    // commit handles head movement
+}
+
+// find RS set and an available RS for opcode
+bool Simulator::find_free_rs_for_opcode(int opcode, int& rs_set_idx, int& rs_idx) const
+{
+    int fam = (int)OPCODES[opcode].family;
+    for (size_t j = 0; j < RS_sets[fam].size(); ++j)
+    {
+        if (!RS_sets[fam][j].busy)
+        {
+            rs_set_idx = fam;
+            rs_idx = (int)j;
+            return true;
+        }
+    }
+    return false;
+}
+
+// RS can start: operands ready, or only the base for a STORE (data may arrive later)
+bool rs_can_start(const RS& rs)
+{
+    return rs.Qj == -1 && (rs.Qk == -1 || rs.opcode == (int)Op::STORE);
+}
+
+// CDB broadcast: hand ROB[tag].value to exactly the RS entries waiting on it
+void Simulator::wakeup(int tag)
+{
+    const int val = ROB[tag].value;
+    for (int slot : rob_waiters[tag])
+    {
+        RS& rs = *rs_by_slot[slot];
+        if (!rs.busy)
+            continue; // flushed since it registered
+        if (rs.Qj == tag)
+        {
+            rs.Vj = val;
+            rs.Qj = -1;
+        }
+        if (rs.Qk == tag)
+        {
+            rs.Vk = val;
+            rs.Qk = -1;
+            if (rs.exec_finished)
+                timing[rs.rob_dest].cdb_ready = cycle_num; // a STORE that was only waiting for its data
+        }
+        if (!rs.exec_started && rs_can_start(rs))
+            start_queue.push_back(slot);
+    }
+    rob_waiters[tag].clear();
+}
+
+// Squash everything younger than ROB entry rob_idx, youngest first: free
+// their RS entries and ROB slots and undo their renames. Only the squashed
+// entries are visited.
+template <int R>
+void Simulator::squash_after(int rob_idx)
+{
+    // a sampled step times the flush on its own, not as part of its caller
+    int outer = (PROFILE_PROBES && profile && profile->stage >= 0) ? profile->switch_to((int)HostStage::FLUSH) : -1;
+    for (int i = rob_prev<R>(rob_tail); i != rob_idx; i = rob_prev<R>(i))
+        if (ROB[i].busy)
+        {
+            const MicroOp* u = ROB[i].instr_id >= 0 ? &program[ROB[i].instr_id].uop : nullptr;
+            stalls.slot(u ? (int)u->family : NUM_RS_FAMILIES, SlotUse::SQUASHED);
+            // an RS freed by the write may since hold a younger entry, which
+            // frees it itself
+            if (rob_rs_slot[i] != -1)
+            {
+                RS* rs = rs_by_slot[rob_rs_slot[i]];
+                if (rs->busy && rs->rob_dest == i)
+                    rs->clear();
+            }
+            // the previous producer of dest, unless it has committed since.
+            // Its slot cannot hold a newer entry now: that would be younger
+            // than i, and so already freed.
+            if (u && u->writes_reg)
+            {
+                int tag = rename_undo[i];
+                reg_tag[u->dest] = tag != -1 && ROB[tag].busy ? tag : -1;
+            }
+            ROB[i].clear();
+            rob_waiters[i].clear();
+            --rob_count;
+        }
+    rob_tail = rob_next<R>(rob_idx);
+    recovery_seq = next_seq;
+    while (!lsq_order.empty() && !ROB[lsq_order.back()].busy)
+        lsq_order.pop_back();
+    if (outer >= 0)
+        profile->switch_to(outer);
+}
+
+// rob_rs_slot and rename_undo for the in-flight entries of a restored
+// checkpoint. A producer that has committed since leaves -1, as it would
+// on undo.
+void Simulator::rebuild_squash_links()
+{
+    fill(rob_rs_slot.begin(), rob_rs_slot.end(), -1);
+    for (size_t slot = 0; slot < rs_by_slot.size(); ++slot)
+        if (rs_by_slot[slot]->busy)
+            rob_rs_slot[rs_by_slot[slot]->rob_dest] = (int)slot;
+    vector<int> tag(cfg.num_reg, -1);
+    for (int i = rob_head, n = 0; n < rob_count; i = rob_next<0>(i), ++n)
+        if (ROB[i].instr_id >= 0)
+        {
+            const MicroOp& u = program[ROB[i].instr_id].uop;
+            if (!u.writes_reg)
+                continue;
+            rename_undo[i] = tag[u.dest];
+            tag[u.dest] = i;
+        }
+}
+
+// Check a branch's prediction against its outcome (ROB value, once written).
+// On a mispredict the wrong path is squashed, fetch restarts on the right
+// one and the global history is repaired.
+template <int R>
+void Simulator::resolve_branch(int rob_idx)
+{
+    BranchInfo& bi = branch_info[rob_idx];
+    if (bi.resolved)
+        return;
+    bi.resolved = true;
+    const ROBEntry& e = ROB[rob_idx];
+    bool taken = e.value != 0;
+    if (taken == bi.predicted)
+        return;
+    bi.mispredicted = true;
+    squash_after<R>(rob_idx);
+    redirect_fetch(taken ? e.br_target : e.pc_on_issue + 1);
+    ghr = bi.hist << 1 | (taken ? 1 : 0);
+    restore_ras(rob_idx);
+}
+
+// Check a RET's predicted return address against R1 (with the RAS on, at
+// write). A wrong one squashes everything fetched from it.
+template <int R>
+void Simulator::resolve_return(int rob_idx)
+{
+    BranchInfo& bi = branch_info[rob_idx];
+    if (bi.resolved)
+        return;
+    bi.resolved = true;
+    const ROBEntry& e = ROB[rob_idx];
+    if (e.br_target == bi.target)
+        return;
+    bi.mispredicted = true;
+    squash_after<R>(rob_idx);
+    redirect_fetch(e.br_target);
+    restore_ras(rob_idx);
+}
+
+void Simulator::save_ras(int rob_idx)
+{
+    if (cfg.ras_entries == 0)
+        return;
+    BranchInfo& bi = branch_info[rob_idx];
+    bi.ras_top = ras.top;
+    bi.ras_count = ras.count;
+    copy(ras.addr.begin(), ras.addr.end(), ras_snap.begin() + (size_t)rob_idx * cfg.ras_entries);
+}
+
+// the stack as it was right after rob_idx issued, undoing the wrong path's
+// pushes and pops
+void Simulator::restore_ras(int rob_idx)
+{
+    if (cfg.ras_entries == 0)
+        return;
+    const BranchInfo& bi = branch_info[rob_idx];
+    ras.top = bi.ras_top;
+    ras.count = bi.ras_count;
+    auto first = ras_snap.begin() + (size_t)rob_idx * cfg.ras_entries;
+    copy(first, first + cfg.ras_entries, ras.addr.begin());
+}
+
+// a LOAD or STORE was issued into rob_idx (timing seq already assigned)
+void Simulator::lsq_issue(int rob_idx, const Instr& ins)
+{
+    lsq_order.push_back(rob_idx);
+    LSQEntry& m = lsq[rob_idx];
+    m = LSQEntry();
+    if (!store_sets.enabled())
+        return;
+    int set = store_sets.set_of(ins.addr);
+    if (set == -1)
+        return;
+    auto& last = store_sets.lfst[set];
+    if (ins.uop.op == Op::STORE)
+        last = { rob_idx, timing[rob_idx].seq };
+    else if (last.first != -1 && ROB[last.first].busy && timing[last.first].seq == last.second)
+    {
+        m.wait_rob = last.first;
+        m.wait_seq = last.second;
+        ++lsq_waits;
+    }
+}
+
+// A store's address is known. With cfg.lsq, the oldest younger load that
+// already read that address from something older than this store is replayed.
+void Simulator::store_address_ready(int rob_idx, int addr)
+{
+    LSQEntry& st = lsq[rob_idx];
+    st.addr_ready = true;
+    st.addr = addr;
+    if (!cfg.lsq)
+        return;
+    const long long seq = timing[rob_idx].seq;
+    int victim = -1;
+    for (auto it = lsq_order.rbegin(); it != lsq_order.rend() && *it != rob_idx; ++it)
+    {
+        const LSQEntry& m = lsq[*it];
+        if (ROB[*it].type != ROBType::STORE && m.addr_ready && m.addr == addr && m.source < seq)
+            victim = *it;
+    }
+    if (victim == -1)
+        return;
+    if (store_sets.enabled())
+        store_sets.train(ROB[victim].pc_on_issue, ROB[rob_idx].pc_on_issue);
+    replay_load(victim);
+}
+
+// youngest store older than load_idx whose address is known to be addr, or -1
+int Simulator::older_store(int load_idx, int addr) const
+{
+    auto it = find(lsq_order.rbegin(), lsq_order.rend(), load_idx);
+    if (it == lsq_order.rend())
+        return -1;
+    for (++it; it != lsq_order.rend(); ++it)
+        if (ROB[*it].type == ROBType::STORE && lsq[*it].addr_ready && lsq[*it].addr == addr)
+            return *it;
+    return -1;
+}
+
+// a finished LOAD may not write yet: its predicted store has no address, or
+// the store it would forward from has no data
+bool Simulator::load_blocked(const RS& rs) const
+{
+    const LSQEntry& m = lsq[rs.rob_dest];
+    if (m.wait_rob != -1 && ROB[m.wait_rob].busy && timing[m.wait_rob].seq == m.wait_seq && !lsq[m.wait_rob].addr_ready)
+        return true;
+    int st = older_store(rs.rob_dest, wrap16(rs.Vj + rs.A));
+    return st != -1 && !ROB[st].ready;
+}
+
+// the value a LOAD at rob_idx reads from addr, when it writes
+int Simulator::load_value(int rob_idx, int addr)
+{
+    LSQEntry& m = lsq[rob_idx];
+    m.addr_ready = true;
+    m.addr = addr;
+    int st = cfg.lsq ? older_store(rob_idx, addr) : -1;
+    if (st != -1)
+    {
+        m.source = timing[st].seq;
+        return ROB[st].value;
+    }
+    return (addr >= 0 && addr < MEM_SIZE) ? memory_mem.read(addr) : 0;
+}
+
+// The LOAD at rob_idx read a stale value: squash it and everything younger,
+// and fetch again from the load with the history and RAS it issued with
+void Simulator::replay_load(int rob_idx)
+{
+    int pc = ROB[rob_idx].pc_on_issue;
+    squash_after<0>(rob_prev<0>(rob_idx));
+    redirect_fetch(pc);
+    ghr = branch_info[rob_idx].hist;
+    restore_ras(rob_idx);
+    ++lsq_replays;
+}
+
+// ---------------- Decode ----------------
+Operand decode_operand(int token, int num_reg)
+{
+    Operand o;
+    if (token >= 0 && token < num_reg)
+    {
+        if (token != 0)
+            o.reg = token; // R0 reads as constant 0
+    }
+    else
+        o.imm = token; // immediate or out-of-range treated immediate
+    return o;
+}
+
+// fill ins.uop from the raw fields; false for an unknown opcode
+bool decode_instr(Instr& ins, int num_reg)
+{
+    if (!valid_opcode(ins.opcode))
+        return false;
+    const OpInfo& info = OPCODES[ins.opcode];
+    MicroOp& u = ins.uop;
+    u = MicroOp();
+    u.op = (Op)ins.opcode;
+    u.family = info.family;
+    u.rob_type = info.rob_type;
+    switch (u.op)
+    {
+    case Op::LOAD: // 1 rd rs1 imm  => LOAD rd, imm(rs1)
+        u.j = decode_operand(ins.rs1, num_reg);
+        u.A = ins.rs2_imm;
+        u.dest = ins.rd;
+        break;
+    case Op::STORE: // 2 rs2 rs1 imm => STORE rs2, imm(rs1)
+        u.j = decode_operand(ins.rs1, num_reg);
+        u.k = decode_operand(ins.rd, num_reg);
+        u.A = ins.rs2_imm;
+        break;
+    case Op::BEQ: // 3 rs1 rs2 imm => BEQ rs1, rs2, imm
+        u.j = decode_operand(ins.rd, num_reg);
+        u.k = decode_operand(ins.rs1, num_reg);
+        u.target = ins.addr + 1 + ins.rs2_imm;
+        break;
+    case Op::CALL: // 8 0 0 imm => CALL imm, R1 holds return address
+        u.dest = 1;
+        u.target = ins.rs2_imm;
+        break;
+    case Op::RET: // 9 0 0 0 => RET, depends on R1
+        u.j.reg = 1;
+        break;
+    case Op::HALT: // 10 0 0 0 => HALT, ends the run when it commits
+        break;
+    default: // ALU ops: ADD/SUB/NAND/MUL  (4 rd rs1 rs2)
+        u.j = decode_operand(ins.rs1, num_reg);
+        u.k = decode_operand(ins.rs2_imm, num_reg);
+        u.dest = ins.rd;
+        break;
+    }
+    u.writes_reg = (u.rob_type == ROBType::REG || u.rob_type == ROBType::CALL) && u.dest > 0 && u.dest < num_reg;
+    return true;
+}
+
+// ---------------- Parsing ----------------
+bool load_program_text(istream& f, Program& prog)
+{
+    string line;
+    vector<string> lines;
+    while (getline(f, line))
+    {
+        // strip comments (# or //)
+        size_t p = line.find('#');
+        if (p != string::npos)
+            line = line.substr(0, p);
+        p = line.find("//");
+        if (p != string::npos)
+            line = line.substr(0, p);
+        // trim
+        auto trim = [](string s) -> string
+            {
+                size_t a = 0;
+                while (a < s.size() && isspace((unsigned char)s[a]))
+                    ++a;
+                size_t b = s.size();
+                while (b > a && isspace((unsigned char)s[b - 1]))
+                    --b;
+                return s.substr(a, b - a);
+            };
+        line = trim(line);
+        if (line.empty())
+            continue;
+        lines.push_back(line);
+    }
+    if (lines.empty())
+    {
+        cerr << "Empty program file\n";
+        return false;
+    }
+    // first non-empty line is starting address
+    int startPC = 0;
+    auto r = from_chars(lines[0].data(), lines[0].data() + lines[0].size(), startPC);
+    if (r.ec != errc() || r.ptr != lines[0].data() + lines[0].size())
+    {
+        cerr << "Bad start address: " << lines[0] << "\n";
+        return false;
+    }
+    prog.start_pc = startPC;
+    // remaining lines are instructions
+    vector<Instr>& program = prog.instrs;
+    program.clear();
+    int idx = 0;
+    for (size_t i = 1; i < lines.size(); ++i)
+    {
+        istringstream iss(lines[i]);
+        int opcode, a, b, c;
+        if (!(iss >> opcode >> a >> b >> c))
+        {
+            cerr << "Bad instruction format on line " << i + 1 << ": " << lines[i] << "\n";
+            return false;
+        }
+        Instr ins;
+        ins.id = idx;
+        ins.addr = startPC + idx;
+        ins.opcode = opcode;
+        ins.rd = a;
+        ins.rs1 = b;
+        ins.rs2_imm = c;
+        if (!decode_instr(ins, prog.num_reg))
+        {
+            cerr << "Unknown opcode on line " << i + 1 << ": " << lines[i] << "\n";
+            return false;
+        }
+        program.push_back(ins);
+        ++idx;
+    }
+    // keep the source lines alive for the report; Instr::text only views them
+    prog.text_lines = move(lines);
+    for (size_t i = 0; i < program.size(); ++i)
+        program[i].text = prog.text_lines[i + 1];
+    return true;
+}
+
+bool load_program_file(const string& fname, Program& prog)
+{
+    ifstream f(fname);
+    if (!f)
+    {
+        cerr << "Cannot open program file: " << fname << "\n";
+        return false;
+    }
+    return load_program_text(f, prog);
+}
+
+// ---------------- Binary program image ----------------
+// Pre-decoded program so large generated programs skip text parsing.
+// Layout (host byte order, little-endian on every supported target):
+//   ProgImageHeader
+//   PackedInstr[count]
+//   optional text table: uint32 offsets[count + 1], then text_bytes of text
+const char PROG_IMAGE_MAGIC[4] = { 'T', 'P', 'I', 'M' };
+const uint32_t PROG_IMAGE_VERSION = 1;
+
+struct ProgImageHeader
+{
+    char magic[4];
+    uint32_t version;
+    int32_t start_pc;
+    uint32_t count;      // number of instructions
+    uint32_t text_bytes; // size of the text blob, 0 if no text table
+};
+
+struct PackedInstr
+{
+    int32_t imm; // rs2 or immediate
+    int16_t rd;
+    int16_t rs1;
+    uint8_t opcode;
+    uint8_t pad[3];
+};
+static_assert(sizeof(ProgImageHeader) == 20, "image header must stay packed");
+static_assert(sizeof(PackedInstr) == 12, "image instruction must stay packed");
+
+bool is_program_image(const string& fname)
+{
+    ifstream f(fname, ios::binary);
+    char magic[4];
+    if (!f.read(magic, 4))
+        return false;
+    return memcmp(magic, PROG_IMAGE_MAGIC, 4) == 0;
+}
+
+// decode the image held by prog.image, which keeps the text table alive for
+// Instr::text; fname only names it in messages
+bool parse_program_image(Program& prog, const string& fname)
+{
+    const MappedFile& program_image = prog.image;
+    const char* base = program_image.data;
+    size_t size = program_image.size;
+    ProgImageHeader h;
+    if (size < sizeof(h))
+    {
+        cerr << "Truncated program image: " << fname << "\n";
+        return false;
+    }
+    memcpy(&h, base, sizeof(h));
+    if (memcmp(h.magic, PROG_IMAGE_MAGIC, 4) != 0 || h.version != PROG_IMAGE_VERSION)
+    {
+        cerr << "Bad program image header: " << fname << "\n";
+        return false;
+    }
+    if (h.count == 0)
+    {
+        cerr << "Empty program image\n";
+        return false;
+    }
+    size_t need = sizeof(h) + (size_t)h.count * sizeof(PackedInstr);
+    if (h.text_bytes > 0)
+        need += ((size_t)h.count + 1) * sizeof(uint32_t) + h.text_bytes;
+    if (size < need)
+    {
+        cerr << "Truncated program image: " << fname << "\n";
+        return false;
+    }
+    // the header is 4-byte sized and the mapping (or copy) suitably aligned, so the arrays are aligned
+    const PackedInstr* packed = (const PackedInstr*)(base + sizeof(h));
+    const uint32_t* offsets = (const uint32_t*)(packed + h.count);
+    const char* text = (const char*)(offsets + h.count + 1);
+
+    int startPC = prog.start_pc = h.start_pc;
+    vector<Instr>& program = prog.instrs;
+    program.clear();
+    program.resize(h.count);
+    prog.text_lines.clear();
+    for (uint32_t i = 0; i < h.count; ++i)
+    {
+        Instr& ins = program[i];
+        ins.id = (int)i;
+        ins.addr = startPC + (int)i;
+        ins.opcode = packed[i].opcode;
+        ins.rd = packed[i].rd;
+        ins.rs1 = packed[i].rs1;
+        ins.rs2_imm = packed[i].imm;
+        if (!decode_instr(ins, prog.num_reg))
+        {
+            cerr << "Unknown opcode " << ins.opcode << " in program image: " << fname << "\n";
+            return false;
+        }
+        if (h.text_bytes > 0)
+        {
+            uint32_t a = offsets[i], b = offsets[i + 1];
+            if (a > b || b > h.text_bytes)
+            {
+                cerr << "Bad text table in program image: " << fname << "\n";
+                return false;
+            }
+            ins.text = string_view(text + a, b - a);
+        }
+    }
+    return true;
+}
+
+bool load_program_image(const string& fname, Program& prog)
+{
+    if (!prog.image.open(fname))
+    {
+        cerr << "Cannot open program image: " << fname << "\n";
+        return false;
+    }
+    return parse_program_image(prog, fname);
+}
+
+// dump a loaded program as a binary image
+bool write_program_image(const Program& prog, const string& fname, bool with_text)
+{
+    const vector<Instr>& program = prog.instrs;
+    ofstream f(fname, ios::binary);
+    if (!f)
+    {
+        cerr << "Cannot write program image: " << fname << "\n";
+        return false;
+    }
+    ProgImageHeader h;
+    memcpy(h.magic, PROG_IMAGE_MAGIC, 4);
+    h.version = PROG_IMAGE_VERSION;
+    h.start_pc = prog.start_pc;
+    h.count = (uint32_t)program.size();
+    h.text_bytes = 0;
+    vector<uint32_t> offsets;
+    if (with_text)
+    {
+        offsets.reserve(program.size() + 1);
+        for (auto& ins : program)
+        {
+            offsets.push_back(h.text_bytes);
+            h.text_bytes += (uint32_t)ins.text.size();
+        }
+        offsets.push_back(h.text_bytes);
+    }
+    f.write((const char*)&h, sizeof(h));
+    for (auto& ins : program)
+    {
+        if (ins.rd != (int16_t)ins.rd || ins.rs1 != (int16_t)ins.rs1 || ins.opcode < 0 || ins.opcode > 255)
+        {
+            cerr << "Instruction does not fit the image format: " << ins.text << "\n";
+            return false;
+        }
+        PackedInstr p = {};
+        p.imm = ins.rs2_imm;
+        p.rd = (int16_t)ins.rd;
+        p.rs1 = (int16_t)ins.rs1;
+        p.opcode = (uint8_t)ins.opcode;
+        f.write((const char*)&p, sizeof(p));
+    }
+    if (with_text)
+    {
+        f.write((const char*)offsets.data(), offsets.size() * sizeof(uint32_t));
+        for (auto& ins : program)
+            f.write(ins.text.data(), ins.text.size());
+    }
+    return (bool)f;
+}
+
+// binary image if the file carries the image magic, text format otherwise
+bool load_program(const string& fname, Program& prog)
+{
+    if (is_program_image(fname))
+        return load_program_image(fname, prog);
+    prog.image.close();
+    return load_program_file(fname, prog);
+}
+
+// same, from bytes in memory (copied: the caller's buffer need not outlive prog)
+bool load_program_buffer(const char* data, size_t size, Program& prog)
+{
+    if (size >= 4 && memcmp(data, PROG_IMAGE_MAGIC, 4) == 0)
+    {
+        prog.image.copy(data, size);
+        return parse_program_image(prog, "<buffer>");
+    }
+    prog.image.close();
+    istringstream f(string(data, size));
+    return load_program_text(f, prog);
+}
+
+// "addr value" lines into img
+void parse_memory_text(const char* p, const char* end, MemoryImage& img)
+{
+    while (p < end)
+    {
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        if (!eol)
+            eol = end;
+        // "addr value" per line; anything that does not parse is skipped
+        const char* q = p;
+        while (q < eol && isspace((unsigned char)*q))
+            ++q;
+        int addr, val;
+        auto r1 = from_chars(q, eol, addr);
+        if (r1.ec == errc())
+        {
+            q = r1.ptr;
+            while (q < eol && isspace((unsigned char)*q))
+                ++q;
+            auto r2 = from_chars(q, eol, val);
+            if (r2.ec == errc() && addr >= 0 && addr < MEM_SIZE)
+                img.own_page(addr >> MEM_PAGE_BITS)[addr & MEM_PAGE_MASK] = (uint16_t)wrap16(val);
+        }
+        p = eol + 1;
+    }
+    img.finish_loading();
+}
+
+bool load_memory_file(const string& fname, shared_ptr<const MemoryImage>& memory_base)
+{
+    MappedFile f;
+    if (!f.open(fname))
+    {
+        // not fatal: memory stays zero
+        return false;
+    }
+    auto img = make_shared<MemoryImage>();
+    parse_memory_text(f.data, f.data + f.size, *img);
+    memory_base = img;
+    return true;
+}
+
+// ---------------- Binary memory image ----------------
+// Layout: MemImageHeader, then uint16 words[words] for addresses 0..words-1.
+const char MEM_IMAGE_MAGIC[4] = { 'T', 'M', 'I', 'M' };
+const uint32_t MEM_IMAGE_VERSION = 1;
+
+struct MemImageHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t words;
+    uint32_t reserved;
+};
+static_assert(sizeof(MemImageHeader) == 16, "memory image header must stay packed");
+
+// decode the image held by img.file; fname only names it in messages
+bool parse_memory_image(MemoryImage& img, const string& fname)
+{
+    MemImageHeader h;
+    if (img.file.size < sizeof(h))
+    {
+        cerr << "Truncated memory image: " << fname << "\n";
+        return false;
+    }
+    memcpy(&h, img.file.data, sizeof(h));
+    if (memcmp(h.magic, MEM_IMAGE_MAGIC, 4) != 0 || h.version != MEM_IMAGE_VERSION ||
+        img.file.size < sizeof(h) + (size_t)h.words * sizeof(uint16_t))
+    {
+        cerr << "Bad memory image: " << fname << "\n";
+        return false;
+    }
+    // zero-copy: whole pages point straight into the mapping, a trailing
+    // partial page is copied
+    const uint16_t* words = (const uint16_t*)(img.file.data + sizeof(h));
+    size_t count = min<size_t>(h.words, MEM_SIZE);
+    for (size_t first = 0; first < count; first += MEM_PAGE_WORDS)
+    {
+        int page = (int)(first >> MEM_PAGE_BITS);
+        size_t n = min<size_t>(MEM_PAGE_WORDS, count - first);
+        if (n == MEM_PAGE_WORDS)
+            img.pages[page] = words + first;
+        else
+            memcpy(img.own_page(page), words + first, n * sizeof(uint16_t));
+    }
+    img.finish_loading();
+    return true;
+}
+
+bool load_memory_image(const string& fname, shared_ptr<const MemoryImage>& memory_base)
+{
+    auto img = make_shared<MemoryImage>();
+    if (!img->file.open(fname) || !parse_memory_image(*img, fname))
+        return false;
+    memory_base = img;
+    return true;
+}
+
+// dump memory_base up to its last nonzero word
+bool write_memory_image(const shared_ptr<const MemoryImage>& memory_base, const string& fname)
+{
+    ofstream f(fname, ios::binary);
+    if (!f)
+    {
+        cerr << "Cannot write memory image: " << fname << "\n";
+        return false;
+    }
+    size_t words = 0;
+    if (memory_base)
+        for (int page : memory_base->present)
+            for (int i = 0; i < MEM_PAGE_WORDS; ++i)
+                if (memory_base->pages[page][i] != 0)
+                    words = ((size_t)page << MEM_PAGE_BITS) + i + 1;
+    MemImageHeader h;
+    memcpy(h.magic, MEM_IMAGE_MAGIC, 4);
+    h.version = MEM_IMAGE_VERSION;
+    h.words = (uint32_t)words;
+    h.reserved = 0;
+    f.write((const char*)&h, sizeof(h));
+    static const uint16_t zero_page[MEM_PAGE_WORDS] = {};
+    for (size_t first = 0; first < words; first += MEM_PAGE_WORDS)
+    {
+        const uint16_t* pg = memory_base->pages[first >> MEM_PAGE_BITS];
+        f.write((const char*)(pg ? pg : zero_page), min<size_t>(MEM_PAGE_WORDS, words - first) * sizeof(uint16_t));
+    }
+    return (bool)f;
+}
+
+bool is_memory_image(const string& fname)
+{
+    ifstream f(fname, ios::binary);
+    char magic[4];
+    if (!f.read(magic, 4))
+        return false;
+    return memcmp(magic, MEM_IMAGE_MAGIC, 4) == 0;
+}
+
+// binary image if the file carries the image magic, text format otherwise
+bool load_memory(const string& fname, shared_ptr<const MemoryImage>& memory_base)
+{
+    if (is_memory_image(fname))
+        return load_memory_image(fname, memory_base);
+    return load_memory_file(fname, memory_base);
+}
+
+// same, from bytes in memory (copied: the caller's buffer need not outlive the image)
+bool load_memory_buffer(const char* data, size_t size, shared_ptr<const MemoryImage>& memory_base)
+{
+    auto img = make_shared<MemoryImage>();
+    if (size >= 4 && memcmp(data, MEM_IMAGE_MAGIC, 4) == 0)
+    {
+        img->file.copy(data, size);
+        if (!parse_memory_image(*img, "<buffer>"))
+            return false;
+    }
+    else
+        parse_memory_text(data, data + size, *img);
+    memory_base = img;
+    return true;
+}
+
+// ---------------- Machine configuration ----------------
+// Config file: one "key = value" per line, '#' or '//' starts a comment.
+//   num_reg, rob_size, issue_width, cdb_count, commit_width
+//   exec.<OP> / commit.<OP>   latency of an opcode, e.g. exec.MUL = 8
+//   rs.<FAMILY>               RS count of a family, e.g. rs.ADD = 3
+//   bp = not-taken|bimodal|gshare|tage, bp.entries, btb.entries,
+//   bp.resolve = commit|write, bp.compare = 0|1, ras.entries
+//   lsq = 0|1, storeset.entries
+// --set key=value applies a single line from the command line.
+bool apply_config_setting(MachineConfig& c, const string& key, const string& value)
+{
+    // keys with named values
+    if (key == "bp" || key == "bp.resolve")
+    {
+        if (key == "bp.resolve" && (value == "commit" || value == "write"))
+        {
+            c.resolve_at_write = value == "write";
+            return true;
+        }
+        for (int k = 0; key == "bp" && k < NUM_BP_KINDS; ++k)
+            if (value == BP_NAMES[k])
+            {
+                c.bp = (BPKind)k;
+                return true;
+            }
+        cerr << "Bad value for " << key << ": '" << value << "'\n";
+        return false;
+    }
+
+    long long v = 0;
+    auto r = from_chars(value.data(), value.data() + value.size(), v);
+    if (r.ec != errc() || r.ptr != value.data() + value.size() || v < 0 || v > 1000000)
+    {
+        cerr << "Bad value for " << key << ": '" << value << "'\n";
+        return false;
+    }
+    auto same = [](const string& a, const char* b) // names in the tables are upper case
+        {
+            return a.size() == strlen(b) && equal(a.begin(), a.end(), b, [](char x, char y) { return toupper((unsigned char)x) == y; });
+        };
+    size_t dot = key.find('.');
+    string group = key.substr(0, dot);
+    string name = dot == string::npos ? string() : key.substr(dot + 1);
+    if (dot == string::npos && key == "num_reg")
+        c.num_reg = (int)v;
+    else if (dot == string::npos && key == "rob_size")
+        c.rob_size = (int)v;
+    else if (dot == string::npos && key == "issue_width")
+        c.issue_width = (int)v;
+    else if (dot == string::npos && key == "cdb_count")
+        c.cdb_count = (int)v;
+    else if (dot == string::npos && key == "commit_width")
+        c.commit_width = (int)v;
+    else if (dot == string::npos && key == "lsq")
+        c.lsq = v != 0;
+    else if (key == "bp.entries")
+        c.bp_entries = (int)v;
+    else if (key == "btb.entries")
+        c.btb_entries = (int)v;
+    else if (key == "bp.compare")
+        c.bp_compare = v != 0;
+    else if (key == "ras.entries")
+        c.ras_entries = (int)v;
+    else if (key == "storeset.entries")
+        c.storeset_entries = (int)v;
+    else if (group == "exec" || group == "commit")
+    {
+        int op = 1;
+        while (op < NUM_OPCODES && !same(name, OPCODES[op].name))
+            ++op;
+        if (op == NUM_OPCODES)
+        {
+            cerr << "Unknown opcode in config key: " << key << "\n";
+            return false;
+        }
+        (group == "exec" ? c.exec_latency : c.commit_latency)[op] = (int)v;
+    }
+    else if (group == "rs")
+    {
+        int f = 0;
+        while (f < NUM_RS_FAMILIES && !same(name, RS_FAMILY_NAMES[f]))
+            ++f;
+        if (f == NUM_RS_FAMILIES)
+        {
+            cerr << "Unknown RS family in config key: " << key << "\n";
+            return false;
+        }
+        c.rs_counts[f] = (int)v;
+    }
+    else
+    {
+        cerr << "Unknown config key: " << key << "\n";
+        return false;
+    }
+    return true;
+}
+
+// "key=value" or "key = value"
+bool apply_config_line(MachineConfig& c, string line)
+{
+    for (const char* marker : { "#", "//" })
+    {
+        size_t p = line.find(marker);
+        if (p != string::npos)
+            line.erase(p);
+    }
+    auto trim = [](string s)
+        {
+            size_t b = s.find_first_not_of(" \t\r"), e = s.find_last_not_of(" \t\r");
+            return b == string::npos ? string() : s.substr(b, e - b + 1);
+        };
+    line = trim(line);
+    if (line.empty())
+        return true;
+    size_t eq = line.find('=');
+    if (eq == string::npos)
+    {
+        cerr << "Config line needs key = value: " << line << "\n";
+        return false;
+    }
+    return apply_config_setting(c, trim(line.substr(0, eq)), trim(line.substr(eq + 1)));
+}
+
+bool load_config_file(MachineConfig& c, const string& fname)
+{
+    ifstream f(fname);
+    if (!f)
+    {
+        cerr << "Cannot open config file: " << fname << "\n";
+        return false;
+    }
+    string line;
+    while (getline(f, line))
+        if (!apply_config_line(c, line))
+            return false;
+    return true;
+}
+
+bool validate_config(const MachineConfig& c)
+{
+    bool ok = true;
+    auto check = [&](bool cond, const string& what)
+        {
+            if (!cond)
+                cerr << "Invalid machine config: " << what << "\n";
+            ok = ok && cond;
+        };
+    check(c.num_reg >= 2, "num_reg must be at least 2 (CALL/RET use R1)");
+    check(c.rob_size >= 1, "rob_size must be at least 1");
+    check(c.issue_width >= 1, "issue_width must be at least 1");
+    check(c.cdb_count >= 1, "cdb_count must be at least 1");
+    for (int op = 1; op < NUM_OPCODES; ++op)
+        if (op != (int)Op::HALT)
+            check(c.exec_latency[op] >= 1, string("exec.") + OPCODES[op].name + " must be at least 1");
+    for (int f = 0; f < NUM_RS_FAMILIES; ++f)
+        check(c.rs_counts[f] >= 1, string("rs.") + RS_FAMILY_NAMES[f] + " must be at least 1");
+    check(c.bp_entries >= 16 && (c.bp_entries & (c.bp_entries - 1)) == 0, "bp.entries must be a power of two, at least 16");
+    check((c.btb_entries & (c.btb_entries - 1)) == 0, "btb.entries must be 0 or a power of two");
+    check(c.ras_entries <= 1024, "ras.entries must be at most 1024");
+    check((c.storeset_entries & (c.storeset_entries - 1)) == 0, "storeset.entries must be 0 or a power of two");
+    return ok;
+}
+
+// the effective configuration, in config-file syntax
+void print_config(const MachineConfig& c)
+{
+    cout << "num_reg = " << c.num_reg << "\n";
+    cout << "rob_size = " << c.rob_size << "\n";
+    cout << "issue_width = " << c.issue_width << "\n";
+    cout << "cdb_count = " << c.cdb_count << "\n";
+    cout << "commit_width = " << c.commit_width << "\n";
+    for (int op = 1; op < NUM_OPCODES; ++op)
+        cout << "exec." << OPCODES[op].name << " = " << c.exec_latency[op] << "\n"
+            << "commit." << OPCODES[op].name << " = " << c.commit_latency[op] << "\n";
+    for (int f = 0; f < NUM_RS_FAMILIES; ++f)
+        cout << "rs." << RS_FAMILY_NAMES[f] << " = " << c.rs_counts[f] << "\n";
+    cout << "bp = " << BP_NAMES[(int)c.bp] << "\n";
+    cout << "bp.entries = " << c.bp_entries << "\n";
+    cout << "btb.entries = " << c.btb_entries << "\n";
+    cout << "bp.resolve = " << (c.resolve_at_write ? "write" : "commit") << "\n";
+    cout << "bp.compare = " << (c.bp_compare ? 1 : 0) << "\n";
+    cout << "ras.entries = " << c.ras_entries << "\n";
+    cout << "lsq = " << (c.lsq ? 1 : 0) << "\n";
+    cout << "storeset.entries = " << c.storeset_entries << "\n";
+}
+
+// ---------------- Initialization ----------------
+// the program's register count wins: its operands were decoded for it
+Simulator::Simulator(const MachineConfig& config, shared_ptr<const Program> p, shared_ptr<const MemoryImage> mem)
+    : cfg(config), prog(move(p)), program(prog->instrs), startPC(prog->start_pc)
+{
+    cfg.num_reg = prog->num_reg;
+    prog_hash = program_hash(*prog);
+    memory_mem.attach(move(mem));
+    init_structures();
+}
+
+void Simulator::init_structures()
+{
+    // reset registers and tags
+    regs.assign(cfg.num_reg, 0);
+    reg_tag.assign(cfg.num_reg, -1);
+    // R0 is always zero -- reg_tag irrelevant
+
+    // build RS sets, one per family, with cfg.rs_counts entries each
+    RS_sets.assign(NUM_RS_FAMILIES, vector<RS>());
+    for (int f = 0; f < NUM_RS_FAMILIES; ++f)
+        RS_sets[f].assign(cfg.rs_counts[f], RS());
+    rs_by_slot.clear();
+    rs_slot_base.clear();
+    for (auto& set : RS_sets)
+    {
+        rs_slot_base.push_back((int)rs_by_slot.size());
+        for (auto& rs : set)
+            rs_by_slot.push_back(&rs);
+    }
+    rob_waiters.assign(cfg.rob_size, vector<int>());
+    rob_rs_slot.assign(cfg.rob_size, -1);
+    rename_undo.assign(cfg.rob_size, -1);
+    start_queue.clear();
+    exec_done_queue = {};
+    write_ready.clear();
+    // clear ROB
+    ROB.assign(cfg.rob_size, ROBEntry());
+    rob_head = rob_tail = rob_count = 0;
+    select_step();
+
+    // cold predictors
+    predictor = make_predictor(cfg.bp, cfg.bp_entries);
+    btb.reset(cfg.btb_entries);
+    ghr = 0;
+    branch_info.assign(cfg.rob_size, BranchInfo());
+    shadow.clear();
+    if (cfg.bp_compare)
+        for (int k = 0; k < NUM_BP_KINDS; ++k)
+            shadow.push_back(make_predictor((BPKind)k, cfg.bp_entries));
+    shadow_misses.assign(shadow.size(), 0);
+    shadow_ghr = 0;
+    committed_branches = 0;
+    ras.reset(cfg.ras_entries);
+    ras_snap.assign((size_t)cfg.rob_size * cfg.ras_entries, 0);
+    ras_hits = ras_misses = 0;
+    lsq.assign(cfg.rob_size, LSQEntry());
+    lsq_order.clear();
+    store_sets.reset(cfg.lsq ? cfg.storeset_entries : 0);
+    lsq_loads = lsq_forwarded = lsq_replays = lsq_waits = 0;
+    stalls = StallCounters();
+    recovery_seq = -1;
+    last_commit_cycle = 0;
+    next_seq = 0;
+
+    cycle_num = 0;
+    cdb_used = 0;
+    branch_count = 0;
+    mispredictions = 0;
+    fast_forwarded = 0;
+
+    committed_log.clear();
+    committed_count = 0;
+
+    clear_timing();
+    PC = startPC;
+    fetch_halted = false;
+    halted = (halt_pc != -1 && PC == halt_pc);
+    halted_at = halted ? PC : -1;
+}
+
+// ---------------- Pipeline stages ----------------
+
+// Issue stage (one instruction per call)
+template <int R>
+void Simulator::do_issue()
+{
+    if (fetch_halted || draining)
+    {
+        stalls.slot(NUM_RS_FAMILIES, SlotUse::FETCH_IDLE);
+        return;
+    }
+    int prog_idx = fetch_index();
+    if (prog_idx == -1)
+    {
+        stalls.slot(NUM_RS_FAMILIES, SlotUse::FETCH_IDLE);
+        return; // PC outside the program: nothing to issue
+    }
+    const Instr& current_ins = program[prog_idx];
+    
+    // If this instruction executed before, its latest execution is now
+    // pending again (from the first attempt, even if issue stalls)
+    if (latest_committed[prog_idx])
+    {
+        latest_committed[prog_idx] = 0;
+        ++uncommitted_instrs;
+    }
+    const MicroOp& u = current_ins.uop;
+    
+    // check ROB free slot
+    int rob_idx = allocROB<R>();
+    if (rob_idx == -1)
+    {
+        stalls.slot((int)u.family, SlotUse::ROB_FULL);
         return; // stall due ROB full
+    }
+    InstrTiming& t = timing[rob_idx];
+    if (u.op == Op::HALT)
+    {
+        // HALT needs no RS: it is complete at issue and stops fetch behind it
+        ROB[rob_idx].ready = true;
+        ROB[rob_idx].instr_id = current_ins.id;
+        ROB[rob_idx].pc_on_issue = current_ins.addr;
+        ROB[rob_idx].type = ROBType::HALT;
+        ROB[rob_idx].commit_remaining = cfg.commit_latency[(int)u.op];
+        rob_rs_slot[rob_idx] = -1;
+        t = InstrTiming();
+        t.issue = cycle_num;
+        t.seq = latest_seq[prog_idx] = next_seq++;
+        fetch_halted = true;
+        return;
+    }
     // find RS free
     int rs_set_idx = -1, rs_idx = -1;
     if (!find_free_rs_for_opcode(current_ins.opcode, rs_set_idx, rs_idx))
     {
-        // no RS available -> rollback ROB alloc and stall
-        rob_tail = (rob_tail - 1 + ROB_SIZE) % ROB_SIZE;
-        --rob_count;
-        return;
+        // no RS available -> rollback ROB alloc and stall; the slot must not
+        // look in flight to the tag checks
+        rob_tail = rob_prev<R>(rob_tail);
+        --rob_count;
+        freeROB(rob_idx);
+        stalls.slot((int)u.family, SlotUse::RS_FULL);
+        return;
+    }
+    RS& rs = RS_sets[rs_set_idx][rs_idx];
+    rs.busy = true;
+    rs.opcode = current_ins.opcode;
+    rs.instr_id = current_ins.id;
+    rs.exec_started = false;
+    rs.Qj = rs.Qk = -1;
+    rs.Vj = rs.Vk = 0;
+    rs.A = u.A;
+    rs.rob_dest = rob_idx;
+
+    // fill ROB entry metadata
+    ROB[rob_idx].busy = true;
+    ROB[rob_idx].ready = false;
+    ROB[rob_idx].instr_id = current_ins.id;
+    ROB[rob_idx].pc_on_issue = current_ins.addr;
+    ROB[rob_idx].type = u.rob_type;
+    ROB[rob_idx].dest = u.dest;
+
+    // read operands: constant, register value, or the tag of the producing ROB entry
+    auto readOperand = [&](const Operand& o, int& val, int& tag)
+        {
+            if (o.reg >= 0 && reg_tag[o.reg] != -1)
+                tag = reg_tag[o.reg];
+            else
+                val = (o.reg >= 0) ? regs[o.reg] : o.imm;
+        };
+    readOperand(u.j, rs.Vj, rs.Qj);
+    readOperand(u.k, rs.Vk, rs.Qk);
+
+    // operands whose producer already wrote are taken now, the rest wait for
+    // the producer's CDB broadcast
+    int slot = rob_rs_slot[rob_idx] = rs_slot_base[rs_set_idx] + rs_idx;
+    auto subscribe = [&](int& V, int& Q)
+        {
+            if (Q == -1)
+                return;
+            if (ROB[Q].ready)
+            {
+                V = ROB[Q].value;
+                Q = -1;
+            }
+            else
+                rob_waiters[Q].push_back(slot);
+        };
+    subscribe(rs.Vj, rs.Qj);
+    subscribe(rs.Vk, rs.Qk);
+    if (rs_can_start(rs))
+        start_queue.push_back(slot);
+
+    bool predict_taken = false;
+    switch (u.op)
+    {
+    case Op::BEQ:
+    {
+        ++branch_count;
+        // branch target = PC_at_issue + 1 + imm
+        ROB[rob_idx].br_target = u.target;
+        // a taken prediction also needs the target from the BTB
+        int btb_target;
+        predict_taken = predictor->predict(current_ins.addr, ghr)
+            && (cfg.btb_entries == 0 || (btb.lookup(current_ins.addr, btb_target) && btb_target == u.target));
+        BranchInfo& bi = branch_info[rob_idx];
+        bi = BranchInfo();
+        bi.predicted = predict_taken;
+        bi.hist = ghr;
+        ghr = ghr << 1 | (predict_taken ? 1 : 0);
+        save_ras(rob_idx);
+        break;
+    }
+    case Op::CALL:
+        ROB[rob_idx].br_target = u.target; // imm (absolute target)
+        // Save return address (PC + 1) in ROB to be written to R1 at commit
+        ROB[rob_idx].value = wrap16(current_ins.addr + 1);
+        if (cfg.ras_entries > 0)
+            ras.push(wrap16(current_ins.addr + 1));
+        break;
+    case Op::LOAD:
+    {
+        // recovery point for a replay
+        BranchInfo& bi = branch_info[rob_idx];
+        bi = BranchInfo();
+        bi.hist = ghr;
+        save_ras(rob_idx);
+        break;
+    }
+    case Op::RET:
+        if (cfg.ras_entries > 0)
+        {
+            // fetch carries on at the predicted return address; an empty
+            // stack predicts the fall-through, as without a RAS
+            BranchInfo& bi = branch_info[rob_idx];
+            bi = BranchInfo();
+            if (!ras.pop(bi.target))
+                bi.target = current_ins.addr + 1;
+            save_ras(rob_idx);
+        }
+        break;
+    default:
+        break;
+    }
+
+    // if ROB writes to register (REG or CALL's R1), set reg_tag
+    if (u.writes_reg)
+    {
+        rename_undo[rob_idx] = reg_tag[u.dest];
+        reg_tag[u.dest] = rob_idx;
+    }
+
+    // set instruction metadata
+    t = InstrTiming();
+    t.issue = cycle_num;
+    t.seq = latest_seq[prog_idx] = next_seq++;
+    if (u.op == Op::LOAD || u.op == Op::STORE)
+        lsq_issue(rob_idx, current_ins);
+
+    // CALL jumps immediately to target address, and so does a branch predicted taken
+    if (u.op == Op::CALL) {
+        redirect_fetch(u.target);  // Jump to call target
+    } else if (predict_taken) {
+        redirect_fetch(u.target);
+    } else if (u.op == Op::RET && cfg.ras_entries > 0) {
+        redirect_fetch(branch_info[rob_idx].target);
+    } else {
+        PC = PC + 1; // sequential next instruction address
+    }
+}
+
+// Execute stage: start RS entries woken in an earlier cycle and finish the
+// ones whose latency runs out this cycle
+void Simulator::do_execute()
+{
+    // reset cdb flag for this cycle
+    cdb_used = 0;
+
+    auto finish = [this](RS& rs, int slot)
+        {
+            const Instr& ins = program[rs.instr_id];
+            InstrTiming& t = timing[rs.rob_dest];
+            t.exec_end = cycle_num;
+            t.cdb_ready = cycle_num; // reset at wakeup for a STORE still waiting for its data
+            rs.exec_finished = true;
+            rs.write_remaining = (ins.uop.op == Op::STORE) ? 0 : 1;
+            write_ready.insert({ t.seq, slot });
+            if (ins.uop.op == Op::STORE)
+                store_address_ready(rs.rob_dest, wrap16(rs.Vj + rs.A)); // can replay younger loads
+        };
+
+    for (int slot : start_queue)
+    {
+        RS& rs = *rs_by_slot[slot];
+        // entries can be stale (flushed, or queued twice); recheck the state
+        if (!rs.busy || rs.exec_started || !rs_can_start(rs))
+            continue;
+        rs.exec_started = true;
+        InstrTiming& t = timing[rs.rob_dest];
+        if (t.exec_start == -1)
+            t.exec_start = cycle_num;
+        // consume one cycle immediately (this cycle), except for a STORE that
+        // starts on its base alone
+        int lat = cfg.exec_latency[rs.opcode];
+        rs.exec_done = (rs.Qk == -1) ? cycle_num + lat - 1 : cycle_num + lat;
+        if (rs.exec_done == cycle_num)
+            finish(rs, slot);
+        else
+            exec_done_queue.push({ rs.exec_done, slot });
+    }
+    start_queue.clear();
+
+    while (!exec_done_queue.empty() && exec_done_queue.top().first <= cycle_num)
+    {
+        int slot = exec_done_queue.top().second;
+        long long done = exec_done_queue.top().first;
+        exec_done_queue.pop();
+        RS& rs = *rs_by_slot[slot];
+        if (rs.busy && rs.exec_started && !rs.exec_finished && rs.exec_done == done)
+            finish(rs, slot);
+    }
+}
+
+// oldest finished RS younger than `after` that can use a CDB, or -1; drops
+// stale queue entries
+int Simulator::oldest_write_ready(pair<long long, int> after)
+{
+    for (auto it = write_ready.upper_bound(after); it != write_ready.end();)
+    {
+        RS& rs = *rs_by_slot[it->second];
+        if (!rs.busy || !rs.exec_finished || timing[rs.rob_dest].seq != it->first)
+        {
+            it = write_ready.erase(it);
+            continue;
+        }
+        if (timing[rs.rob_dest].write != -1 || (rs.opcode == (int)Op::STORE && rs.Qk != -1))
+        {
+            ++it; // already written, or a STORE waiting for its data
+            continue;
+        }
+        if (cfg.lsq && rs.opcode == (int)Op::LOAD && load_blocked(rs))
+        {
+            timing[rs.rob_dest].cdb_ready = cycle_num + 1; // held back by an older store, not by the bus
+            ++it;
+            continue;
+        }
+        return it->second;
+    }
+    return -1;
+}
+
+// Write-back stage: the cfg.cdb_count oldest finished RS entries each get a
+// CDB, in age order, so an older result is always on the bus first. An entry
+// still counting down its write cycle holds its bus for that cycle.
+void Simulator::do_write()
+{
+    // reset cdb flag for this cycle
+    cdb_used = 0;
+
+    pair<long long, int> after = { -1, -1 };
+    while (cdb_used < cfg.cdb_count)
+    {
+        int chosen_slot = oldest_write_ready(after);
+        if (chosen_slot == -1)
+            return;
+        RS& rs = *rs_by_slot[chosen_slot];
+        InstrTiming& t = timing[rs.rob_dest];
+        after = { t.seq, chosen_slot };
+        ++cdb_used;
+        if (t.cdb_ready != -1)
+        {
+            t.cdb_lost = max(0LL, cycle_num - t.cdb_ready);
+            t.cdb_ready = -1;
+        }
+        // countdown write latency, but RET has no extra delay
+        if (rs.opcode != (int)Op::RET && rs.write_remaining > 0)
+        {
+            rs.write_remaining--;
+            continue;
+        }
+        write_result(rs); // may squash younger entries, which the next pick skips
+    }
+}
+
+// put rs's result in its ROB entry and on the CDB
+void Simulator::write_result(RS& rs)
+{
+    const Instr& ins = program[rs.instr_id];
+    const MicroOp& u = ins.uop;
+
+    ROB[rs.rob_dest].commit_remaining = cfg.commit_latency[(int)u.op];
+
+    // write to ROB
+    switch (u.op)
+    {
+    case Op::LOAD:
+    {
+        int addr = wrap16(rs.Vj + rs.A);
+        int val = load_value(rs.rob_dest, addr);
+        ROB[rs.rob_dest].value = val;
+        ROB[rs.rob_dest].ready = true;
+        ROB[rs.rob_dest].dest = ins.rd;
+        break;
+    }
+    case Op::STORE:
+    {
+        // only picked once the data (rs2) is ready
+        int addr = wrap16(rs.Vj + rs.A);
+        ROB[rs.rob_dest].dest = addr;
+        ROB[rs.rob_dest].value = wrap16(rs.Vk);
+        ROB[rs.rob_dest].ready = true;
+        break;
+    }
+    case Op::BEQ:
+        ROB[rs.rob_dest].value = (rs.Vj == rs.Vk) ? 1 : 0;
+        ROB[rs.rob_dest].ready = true;
+        if (cfg.resolve_at_write)
+            resolve_branch<0>(rs.rob_dest);
+        break;
+    case Op::CALL:
+        // Return address already stored in ROB at issue; just mark ready
+        ROB[rs.rob_dest].ready = true;
+        break;
+    case Op::RET:
+        // Store the return address (value of R1) in ROB
+        ROB[rs.rob_dest].value = wrap16(rs.Vj);
+        ROB[rs.rob_dest].br_target = rs.Vj;  // Target address to jump to
+        ROB[rs.rob_dest].ready = true;
+        if (cfg.ras_entries > 0)
+            resolve_return<0>(rs.rob_dest);
+        break;
+    default:
+    {
+        // ALU ops: ADD, SUB, NAND, MUL
+        int result = 0;
+        if (u.op == Op::ADD)
+            result = wrap16(rs.Vj + rs.Vk);
+        else if (u.op == Op::SUB)
+            result = wrap16(rs.Vj - rs.Vk);
+        else if (u.op == Op::NAND)
+            result = wrap16(~(rs.Vj & rs.Vk));
+        else if (u.op == Op::MUL)
+            result = wrap16((int)((unsigned)rs.Vj * (unsigned)rs.Vk)); // 0xFFFF * 0xFFFF overflows int
+
+        ROB[rs.rob_dest].value = result;
+        ROB[rs.rob_dest].dest = ins.rd;
+        ROB[rs.rob_dest].ready = true;
+        break;
+    }
+    }
+
+    timing[rs.rob_dest].write = cycle_num;
+    wakeup(rs.rob_dest);
+
+    // clear RS
+    rs.clear();
+}
+
+
+// do commit stage: commit instructions in-order from ROB head.
+// commit_width = 0 is the original stage: no limit per cycle, but an entry's
+// commit latency only counts down once it is the ROB head, so back-to-back
+// entries commit about one per cycle. commit_width = N commits up to N per
+// cycle and every entry's latency runs from its write, in parallel.
+template <int R>
+void Simulator::do_commit() {
+    for (int n = 0; (cfg.commit_width == 0 || n < cfg.commit_width) && commit_head<R>(); ++n) {
+    }
+}
+
+// commit the ROB head if it is ready and its commit latency has run out;
+// false if nothing was committed
+template <int R>
+bool Simulator::commit_head() {
+    if (rob_count == 0 || halted)
+        return false;
+
+    ROBEntry& e = ROB[rob_head];
+
+    // Can only commit a busy & ready instruction
+    if (!e.busy || !e.ready)
+        return false;
+
+    if (cfg.commit_width > 0) {
+        if (cycle_num < commit_ready_at(rob_head))
+            return false;
+    }
+    else if (e.commit_remaining > 0) {
+        e.commit_remaining--;
+        return false;  // Wait for commit latency
+    }
+
+    // Mark instruction as committed
+    int iid = e.instr_id;
+    if (iid >= 0 && iid < (int)program.size()) {
+        const Instr& ins = program[iid];
+        InstrTiming& t = timing[rob_head];
+        if (!latest_committed[iid] && latest_seq[iid] == t.seq)
+        {
+            latest_committed[iid] = 1;
+            --uncommitted_instrs;
+        }
+        t.commit = cycle_num;
+        int family = (int)ins.uop.family;
+        if (cycle_num != last_commit_cycle)
+        {
+            count_stall_cycles(stalls, rob_head, last_commit_cycle + 1, cycle_num);
+            stalls.cycle(family, CycleCause::COMMIT);
+            last_commit_cycle = cycle_num;
+        }
+        stalls.slot(family, SlotUse::ISSUED);
+        if (recovery_seq != -1 && t.seq >= recovery_seq)
+            recovery_seq = -1; // the refetched path reached commit
+
+        if (ins.uop.op == Op::LOAD || ins.uop.op == Op::STORE)
+        {
+            lsq_order.pop_front(); // the oldest memory instruction
+            if (ins.uop.op == Op::LOAD)
+            {
+                ++lsq_loads;
+                lsq_forwarded += lsq[rob_head].source != -1;
+            }
+        }
+
+        // Log this committed instance so repeated executions are reported separately
+        committed_log.push({ committed_count, iid, ins.addr, t.issue, t.exec_start, t.exec_end, t.write, t.commit });
+        if (trace_out)
+            trace_out->push({ committed_count, ins.addr, ins.opcode, t.issue, t.exec_start, t.exec_end, t.write, t.commit });
+    }
+    ++committed_count;
+
+    // architectural next PC, for the --halt-pc sentinel
+    int next_pc = e.pc_on_issue + 1;
+
+    if (e.type == ROBType::REG) {
+        int rd = e.dest;
+        if (rd > 0 && rd < cfg.num_reg) {  // R0 is read-only
+            regs[rd] = wrap16(e.value);
+            if (reg_tag[rd] == rob_head)
+                reg_tag[rd] = -1;
+        }
+    }
+    else if (e.type == ROBType::STORE) {
+        int addr = e.dest;
+        if (addr >= 0 && addr < MEM_SIZE) {
+            memory_mem.write(addr, wrap16(e.value));
+        }
+    }
+    else if (e.type == ROBType::BR) {
+        bool taken = (e.value != 0);
+        int target = e.br_target;
+        BranchInfo& bi = branch_info[rob_head];
+        resolve_branch<R>(rob_head); // already done at write with bp.resolve = write
+        if (bi.mispredicted)
+            mispredictions++;
+        if (taken)
+            next_pc = target;
+
+        // train on the architectural outcome
+        predictor->update(e.pc_on_issue, bi.hist, taken);
+        if (taken && cfg.btb_entries > 0)
+            btb.insert(e.pc_on_issue, target);
+        ++committed_branches;
+        for (size_t k = 0; k < shadow.size(); ++k)
+        {
+            if (shadow[k]->predict(e.pc_on_issue, shadow_ghr) != taken)
+                ++shadow_misses[k];
+            shadow[k]->update(e.pc_on_issue, shadow_ghr, taken);
+        }
+        shadow_ghr = shadow_ghr << 1 | (taken ? 1 : 0);
+    }
+    else if (e.type == ROBType::CALL) {
+        // Save return address to R1 (value already computed at issue)
+        regs[1] = wrap16(e.value);
+        if (reg_tag[1] == rob_head) reg_tag[1] = -1;
+        // PC was already updated at issue, no jump needed here
+        // No flush - CALL is a direct jump, not a misprediction
+        next_pc = e.br_target;
+    }
+    else if (e.type == ROBType::RET) {
+        next_pc = e.br_target;
+        if (cfg.ras_entries > 0) {
+            // predicted at issue and checked at write, which squashed a wrong path
+            if (branch_info[rob_head].mispredicted)
+                ras_misses++;
+            else
+                ras_hits++;
+        }
+        else {
+            // Jump to return address (stored in br_target during write) and
+            // clear ALL younger speculative instructions (everything after this RET in ROB)
+            redirect_fetch(e.br_target);
+            squash_after<R>(rob_head);
+        }
+    }
+
+    else if (e.type == ROBType::HALT) {
+        halted = true;
+        halted_at = e.pc_on_issue;
+    }
+    if (!halted && halt_pc != -1 && next_pc == halt_pc) {
+        halted = true;
+        halted_at = next_pc;
+    }
+
+    // Free this ROB entry and advance head
+    e.clear();
+    rob_head = rob_next<R>(rob_head);
+    rob_count--;
+    return true;
+}
+
+// first cycle the entry may commit with a bounded commit width: its commit
+// latency after the write (after issue for a HALT, which does not write)
+long long Simulator::commit_ready_at(int rob_idx) const
+{
+    const InstrTiming& t = timing[rob_idx];
+    return (t.write != -1 ? t.write : t.issue) + cfg.commit_latency[program[ROB[rob_idx].instr_id].opcode];
+}
+
+// Charge cycles [from, to), in which nothing committed, to what held up the
+// instruction in ROB slot rob_idx: the oldest in flight all that time, or
+// not issued yet. rob_idx = -1 is an empty ROB.
+void Simulator::count_stall_cycles(StallCounters& out, int rob_idx, long long from, long long to) const
+{
+    auto span = [&](int family, CycleCause c, long long end)
+        {
+            end = min(end, to);
+            if (end > from)
+            {
+                out.cycle(family, c, end - from);
+                from = end;
+            }
+        };
+    if (rob_idx == -1)
+    {
+        bool refill = recovery_seq != -1 && !fetch_halted && !draining && fetch_index() != -1;
+        span(NUM_RS_FAMILIES, refill ? CycleCause::RECOVERY : CycleCause::FRONT_END, to);
+        return;
+    }
+    const InstrTiming& t = timing[rob_idx];
+    const MicroOp& u = program[ROB[rob_idx].instr_id].uop;
+    int family = (int)u.family;
+    bool refetched = recovery_seq != -1 && t.seq >= recovery_seq;
+    span(NUM_RS_FAMILIES, refetched ? CycleCause::RECOVERY : CycleCause::FRONT_END, t.issue);
+    if (refetched)
+        span(family, CycleCause::RECOVERY, to);
+    else if (u.op == Op::HALT)
+        span(family, CycleCause::COMMIT_WAIT, to); // complete at issue
+    else
+    {
+        const long long pending = LLONG_MAX; // timestamp not reached yet
+        span(family, CycleCause::OPERANDS, t.exec_start == -1 ? pending : t.exec_start);
+        if (t.exec_end == -1)
+            span(family, CycleCause::EXECUTE, to);
+        else
+        {
+            // after executing: lost CDB arbitrations and then the write cycle
+            // (none for a STORE or RET), which goes to the bus too if it had
+            // to wait for one; then any wait for data or an older STORE
+            long long done = t.exec_end + 1;
+            long long lost = t.cdb_lost;
+            int write_cycles = (u.op == Op::STORE || u.op == Op::RET) ? 0 : 1;
+            span(family, CycleCause::EXECUTE, done);
+            span(family, CycleCause::CDB, done + lost + (lost > 0 ? write_cycles : 0));
+            span(family, CycleCause::EXECUTE, done + lost + write_cycles);
+            span(family, CycleCause::OPERANDS, t.write == -1 ? pending : t.write);
+        }
+        span(family, CycleCause::COMMIT_WAIT, to);
+    }
+}
+
+// charge `slots` issue slots in which nothing can issue, as do_issue would
+void Simulator::count_issue_stall(long long slots)
+{
+    if (fetch_halted || draining || fetch_index() == -1)
+        stalls.slot(NUM_RS_FAMILIES, SlotUse::FETCH_IDLE, slots);
+    else
+        stalls.slot((int)program[fetch_index()].uop.family, rob_count == cfg.rob_size ? SlotUse::ROB_FULL : SlotUse::RS_FULL, slots);
+}
+
+// single cycle step
+template <int R, int W, bool P>
+bool Simulator::step_impl()
+{
+    // --profile: time each stage of a sampled step (see HostProfile)
+    const bool timed = P && PROFILE_PROBES && profile->sample();
+    auto probe = [&](HostStage s) { if (timed) profile->switch_to((int)s); };
+    auto probe_end = [&]() { if (timed) profile->switch_to(-1); };
+
+    if (program.empty() || halted)
+        return false;
+    probe(HostStage::TERMINATION);
+    if (all_committed())
+    {
+        probe_end();
+        return false;
+    }
+
+    ++cycle_num;
+
+    // order: execute -> write -> commit -> issue (roughly)
+    probe(HostStage::EXECUTE);
+    do_execute();
+    probe(HostStage::WRITE);
+    do_write();
+    probe(HostStage::COMMIT);
+    do_commit<R>();
+    // ISSUE stage: up to issue_width instructions
+    probe(HostStage::ISSUE);
+    for (int i = 0; i < issue_width<W>(); ++i)
+        do_issue<R>();
+    probe_end();
+
+    return true;
+}
+
+// Configurations with a specialised pipeline; anything else runs step_impl<0, 0>.
+// Without the probes the profiled pipelines are the plain ones.
+struct FastPath
+{
+    int rob_size;
+    int issue_width;
+    bool (Simulator::*step)();
+    bool (Simulator::*profiled_step)();
+};
+const FastPath FAST_PATHS[] = {
+    {8, 1, &Simulator::step_impl<8, 1>, &Simulator::step_impl<8, 1, PROFILE_PROBES>},
+    {16, 1, &Simulator::step_impl<16, 1>, &Simulator::step_impl<16, 1, PROFILE_PROBES>},
+    {16, 2, &Simulator::step_impl<16, 2>, &Simulator::step_impl<16, 2, PROFILE_PROBES>},
+    {32, 4, &Simulator::step_impl<32, 4>, &Simulator::step_impl<32, 4, PROFILE_PROBES>},
+    {64, 8, &Simulator::step_impl<64, 8>, &Simulator::step_impl<64, 8, PROFILE_PROBES>} };
+
+// pick the pipeline for cfg (called by init_structures and start_profile)
+void Simulator::select_step()
+{
+    bool profiled = profile != nullptr;
+    step_fn = profiled ? &Simulator::step_impl<0, 0, PROFILE_PROBES> : &Simulator::step_impl<0, 0>;
+    for (auto& fp : FAST_PATHS)
+        if (fp.rob_size == cfg.rob_size && fp.issue_width == cfg.issue_width)
+            step_fn = profiled ? fp.profiled_step : fp.step;
+}
+
+// ---------------- Event-driven cycle skipping ----------------
+// Earliest cycle after cycle_num at which step() can change any state.
+// Cycles before it only count down the ROB head's commit_remaining, which
+// skip_idle_cycles applies in bulk.
+long long Simulator::next_event_cycle()
+{
+    const long long now = cycle_num;
+    long long next = LLONG_MAX;
+
+    // do_issue: the first attempt marks the front instruction's latest execution
+    // pending again, then it issues once a ROB entry and an RS of its family are free
+    if (!fetch_halted && !draining && fetch_index() != -1)
+    {
+        const Instr& ins = program[fetch_index()];
+        if (latest_committed[fetch_index()])
+            return now + 1;
+        int rs_set_idx, rs_idx;
+        if (rob_count < cfg.rob_size && (ins.uop.op == Op::HALT || find_free_rs_for_opcode(ins.opcode, rs_set_idx, rs_idx)))
+            return now + 1;
+    }
+
+    // do_execute: woken RS start next cycle, executing ones end at exec_done
+    if (!start_queue.empty())
+        return now + 1;
+    if (!exec_done_queue.empty())
+        next = min<long long>(next, exec_done_queue.top().first);
+
+    // do_write: some RS can count down or write (STOREs waiting for their data
+    // and loads waiting on a store are not candidates)
+    if (oldest_write_ready() != -1)
+        return now + 1;
+
+    // do_commit: the ROB head counts down its commit latency, then commits
+    if (rob_count > 0 && ROB[rob_head].busy && ROB[rob_head].ready)
+        next = min(next, cfg.commit_width > 0 ? max(now + 1, commit_ready_at(rob_head)) : now + ROB[rob_head].commit_remaining + 1);
+
+    return next;
+}
+
+// Advance cycle_num over idle cycles, at most max_skip of them. Returns the
+// number skipped; the following step() then runs the next event cycle.
+long long Simulator::skip_idle_cycles(long long max_skip)
+{
+    if (program.empty() || halted || all_committed())
+        return 0;
+    long long next = next_event_cycle();
+    long long idle = (next == LLONG_MAX) ? max_skip : min(max_skip, next - cycle_num - 1);
+    if (idle <= 0)
+        return 0;
+    // nothing can issue in the skipped cycles either
+    count_issue_stall(idle * cfg.issue_width);
+    if (cfg.commit_width == 0 && rob_count > 0 && ROB[rob_head].busy && ROB[rob_head].ready)
+        ROB[rob_head].commit_remaining -= (int)min<long long>(idle, ROB[rob_head].commit_remaining);
+    cycle_num += idle;
+    return idle;
+}
+
+// Main loop: stop after max_cycles steps (skipped idle cycles included) or
+// once max_commits executions have committed (0 = no cap). Returns the steps.
+long long Simulator::run(long long max_cycles, long long max_commits)
+{
+    long long steps = 0;
+    while (steps < max_cycles && (max_commits == 0 || committed_count < max_commits))
+    {
+        if (event_driven)
+        {
+            steps += skip_idle_cycles(max_cycles - steps);
+            if (steps >= max_cycles)
+                break;
+        }
+        if (!step())
+            break;
+        ++steps;
+    }
+    return steps;
+}
+
+// ---------------- Functional fast-forward and sampling ----------------
+// ISA-level interpreter: executes instructions straight against regs and
+// memory_mem with no pipeline timing, for phases whose timing is not wanted.
+// The pipeline must be empty (see drain()); afterwards PC is the next
+// instruction and the detailed model can pick up from there. Stops after n
+// instructions, at a HALT or the halt PC, or when PC leaves the program.
+// on_instr(program index) is called before each instruction executes.
+template <class F>
+long long Simulator::interpret(long long n, F&& on_instr)
+{
+    if (rob_count > 0)
+        drain();
+    long long done = 0;
+    while (done < n && !halted)
+    {
+        int idx = fetch_index();
+        if (idx == -1)
+            break; // PC outside the program
+        on_instr(idx);
+        const Instr& ins = program[idx];
+        const MicroOp& u = ins.uop;
+        auto val = [&](const Operand& o) { return o.reg >= 0 ? regs[o.reg] : o.imm; };
+        auto set_reg = [&](int rd, int v)
+            {
+                if (rd > 0 && rd < cfg.num_reg)
+                    regs[rd] = wrap16(v);
+            };
+
+        int next_pc = ins.addr + 1;
+        switch (u.op)
+        {
+        case Op::LOAD:
+            set_reg(u.dest, memory_mem.read(wrap16(val(u.j) + u.A)));
+            break;
+        case Op::STORE:
+            memory_mem.write(wrap16(val(u.j) + u.A), wrap16(val(u.k)));
+            break;
+        case Op::BEQ:
+            if (val(u.j) == val(u.k))
+                next_pc = u.target;
+            break;
+        case Op::CALL:
+            regs[1] = wrap16(ins.addr + 1);
+            next_pc = u.target;
+            break;
+        case Op::RET:
+            next_pc = val(u.j);
+            break;
+        case Op::ADD:
+            set_reg(u.dest, val(u.j) + val(u.k));
+            break;
+        case Op::SUB:
+            set_reg(u.dest, val(u.j) - val(u.k));
+            break;
+        case Op::NAND:
+            set_reg(u.dest, ~(val(u.j) & val(u.k)));
+            break;
+        case Op::MUL:
+            set_reg(u.dest, (int)((unsigned)val(u.j) * (unsigned)val(u.k)));
+            break;
+        case Op::HALT:
+            halted = true;
+            halted_at = ins.addr;
+            break;
+        default:
+            break;
+        }
+        ++done;
+        PC = next_pc;
+        if (!halted && halt_pc != -1 && next_pc == halt_pc)
+        {
+            halted = true;
+            halted_at = next_pc;
+        }
+    }
+    fast_forwarded += done;
+    return done;
+}
+
+// Per-instruction timing belongs to the detailed model and starts afresh
+// after a fast-forward, so all_committed() counts from there
+long long Simulator::fast_forward(long long n)
+{
+    long long done = interpret(n, [](int) {});
+    clear_timing();
+    return done;
+}
+
+// Stop fetching and step until everything in flight has committed. The
+// pipeline is then empty and PC is the architectural next PC (a mispredicted
+// branch or RET redirects it on commit). Returns the cycles taken.
+long long Simulator::drain()
+{
+    long long start = cycle_num;
+    draining = true;
+    while (rob_count > 0 && !halted)
+    {
+        if (event_driven)
+            skip_idle_cycles(LLONG_MAX);
+        if (!step())
+            break;
+    }
+    draining = false;
+    return cycle_num - start;
+}
+
+bool Simulator::finished() const
+{
+    return program.empty() || halted || (rob_count == 0 && fetch_index() == -1);
+}
+
+// Sampled run: repeat { fast-forward, detailed warm-up, detailed measurement,
+// drain } and estimate the whole run's CPI from the measured windows. Each
+// window starts from an empty pipeline, which the warm-up absorbs.
+// max_instrs counts every instruction, fast-forwarded or detailed (0 = no cap);
+// max_cycles caps the detailed cycles.
+SampleReport Simulator::run_sampled(const SamplingOptions& o, long long max_cycles, long long max_instrs)
+{
+    SampleReport rep;
+    auto total = [&] { return fast_forwarded + committed_count; };
+    auto budget = [&](long long want) { return max_instrs == 0 ? want : min(want, max_instrs - total()); };
+    auto detailed = [&](long long instrs)
+        {
+            if (instrs > 0 && cycle_num < max_cycles)
+                run(max_cycles - cycle_num, committed_count + instrs);
+        };
+    while (!finished() && cycle_num < max_cycles && (max_instrs == 0 || total() < max_instrs))
+    {
+        long long before = total();
+        fast_forward(budget(o.fast_forward));
+        detailed(budget(o.warmup));
+        long long c0 = cycle_num, i0 = committed_count;
+        detailed(budget(o.detail));
+        if (committed_count > i0)
+            rep.cpi.push_back((double)(cycle_num - c0) / (committed_count - i0));
+        drain();
+        if (total() == before)
+            break; // no progress (stuck outside the program)
+    }
+    rep.instructions = total();
+    rep.detailed_instructions = committed_count;
+    rep.detailed_cycles = cycle_num;
+    return rep;
+}
+
+// two-sided 95% Student t quantile for n - 1 degrees of freedom
+double t95(size_t n)
+{
+    static const double T[] = { 0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+        2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+    size_t df = n - 1;
+    return df < size(T) ? T[df] : 1.96;
+}
+
+void print_sample_report(const SampleReport& rep)
+{
+    size_t n = rep.cpi.size();
+    cout << "\n===== Sampled Simulation =====\n";
+    cout << "Instructions: " << rep.instructions << " (detailed " << rep.detailed_instructions
+        << ", fast-forwarded " << rep.instructions - rep.detailed_instructions << ")\n";
+    cout << "Detailed cycles: " << rep.detailed_cycles << "\n";
+    cout << "Samples: " << n << "\n";
+    if (n == 0)
+        return;
+    double mean = accumulate(rep.cpi.begin(), rep.cpi.end(), 0.0) / n;
+    double var = 0;
+    for (double c : rep.cpi)
+        var += (c - mean) * (c - mean);
+    double half = n > 1 ? t95(n) * sqrt(var / (n - 1)) / sqrt((double)n) : 0;
+    cout << fixed << setprecision(3);
+    cout << "CPI: " << mean << " +/- " << half << " (95% CI)\n";
+    cout << "IPC: " << 1 / mean << " [" << (mean + half > 0 ? 1 / (mean + half) : 0.0) << ", "
+        << (mean - half > 0 ? 1 / (mean - half) : numeric_limits<double>::infinity()) << "]\n";
+    cout << setprecision(0) << "Estimated cycles: " << mean * rep.instructions << " +/- " << half * rep.instructions << "\n";
+    if (n == 1)
+        cout << "(one sample: no confidence interval)\n";
+}
+
+// ---------------- Checkpoints ----------------
+// A checkpoint is the complete mutable state of a Simulator: ROB, RS sets,
+// registers, wakeup/select queues, fetch state, cycle and statistics, plus
+// the memory pages that differ from the base image (the dirty pages only,
+// so checkpoints stay small however large the base is). Restoring needs a
+// Simulator over the same program and base image with the same ROB, RS and
+// register counts; latencies and issue width may differ for what-if runs.
+// Structs are stored as raw bytes: a checkpoint is only read back by the
+// same build, which the header checks.
+const char CKPT_MAGIC[4] = { 'T', 'C', 'K', 'P' };
+const uint32_t CKPT_VERSION = 1;
+
+struct CheckpointHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t layout;      // struct sizes folded together, see ckpt_layout()
+    int32_t rob_size;
+    int32_t num_reg;
+    int32_t rs_counts[NUM_RS_FAMILIES];
+    uint64_t program_hash;
+    uint64_t memory_hash; // base image
+};
+
+uint32_t ckpt_layout()
+{
+    return (uint32_t)(sizeof(RS) << 24 ^ sizeof(ROBEntry) << 16 ^ sizeof(InstrTiming) << 8 ^ sizeof(CommitRecord));
+}
+
+uint64_t program_hash(const Program& prog)
+{
+    uint64_t h = fnv1a(FNV_OFFSET, &prog.start_pc, sizeof(prog.start_pc));
+    for (auto& ins : prog.instrs)
+    {
+        int f[4] = { ins.opcode, ins.rd, ins.rs1, ins.rs2_imm };
+        h = fnv1a(h, f, sizeof(f));
+    }
+    return h;
+}
+
+CheckpointHeader Simulator::checkpoint_header() const
+{
+    CheckpointHeader h = {};
+    memcpy(h.magic, CKPT_MAGIC, 4);
+    h.version = CKPT_VERSION;
+    h.layout = ckpt_layout();
+    h.rob_size = cfg.rob_size;
+    h.num_reg = cfg.num_reg;
+    for (int f = 0; f < NUM_RS_FAMILIES; ++f)
+        h.rs_counts[f] = cfg.rs_counts[f];
+    h.program_hash = prog_hash;
+    h.memory_hash = memory_mem.base ? memory_mem.base->hash : FNV_OFFSET;
+    return h;
+}
+
+// predictor kind and table sizes, packed
+uint64_t Simulator::predictor_setup() const
+{
+    return (uint64_t)cfg.bp | (uint64_t)cfg.bp_entries << 8 | (uint64_t)cfg.btb_entries << 32;
+}
+
+void Simulator::save_checkpoint(string& out) const
+{
+    out.clear();
+    BlobWriter w{ out };
+    w.pod(checkpoint_header());
+
+    w.vec(timing);
+    w.vec(regs);
+    w.vec(reg_tag);
+    for (auto& set : RS_sets)
+        w.vec(set);
+    w.vec(ROB);
+    w.pod(rob_head);
+    w.pod(rob_tail);
+    w.pod(rob_count);
+    for (auto& waiters : rob_waiters)
+        w.vec(waiters);
+    w.vec(start_queue);
+    auto done = exec_done_queue;
+    vector<pair<long long, int>> pending;
+    for (; !done.empty(); done.pop())
+        pending.push_back(done.top());
+    w.vec(pending);
+    w.vec(vector<pair<long long, int>>(write_ready.begin(), write_ready.end()));
+
+    w.pod(PC);
+    w.pod(fetch_halted);
+    w.pod(cycle_num);
+    w.pod(cdb_used);
+    w.pod(uncommitted_instrs);
+    w.pod(halted);
+    w.pod(halted_at);
+    w.pod(committed_count);
+    w.pod(branch_count);
+    w.pod(mispredictions);
+    w.pod(fast_forwarded);
+    w.vec(latest_committed);
+    w.vec(latest_seq);
+    w.pod(next_seq);
+
+    // branch prediction; tables are tagged with their setup so a what-if run
+    // with a different predictor can start with cold ones instead
+    w.vec(branch_info);
+    w.pod(ghr);
+    auto tables = [&](const BranchPredictor& p)
+        {
+            string blob;
+            BlobWriter bw{ blob };
+            p.save(bw);
+            w.vec(vector<char>(blob.begin(), blob.end()));
+        };
+    w.pod(predictor_setup());
+    tables(*predictor);
+    w.vec(btb.pc);
+    w.vec(btb.target);
+    w.pod((uint64_t)shadow.size());
+    for (auto& p : shadow)
+        tables(*p);
+    w.vec(shadow_misses);
+    w.pod(shadow_ghr);
+    w.pod(committed_branches);
+    w.pod(cfg.ras_entries);
+    w.vec(ras.addr);
+    w.pod(ras.top);
+    w.pod(ras.count);
+    w.vec(ras_snap);
+    w.pod(ras_hits);
+    w.pod(ras_misses);
+
+    w.vec(lsq);
+    w.vec(vector<int>(lsq_order.begin(), lsq_order.end()));
+    w.vec(store_sets.ssit);
+    w.vec(store_sets.lfst);
+    w.pod(lsq_loads);
+    w.pod(lsq_forwarded);
+    w.pod(lsq_replays);
+    w.pod(lsq_waits);
+
+    w.pod(stalls);
+    w.pod(recovery_seq);
+    w.pod(last_commit_cycle);
+
+    vector<CommitRecord> history;
+    committed_log.for_each([&](const CommitRecord& r) { history.push_back(r); });
+    w.vec(history);
+
+    // memory: only the pages that were stored to
+    w.pod((uint64_t)memory_mem.dirty_list.size());
+    for (int page : memory_mem.dirty_list)
+    {
+        w.pod(page);
+        out.append((const char*)memory_mem.page(page), MEM_PAGE_WORDS * sizeof(uint16_t));
+    }
+}
+
+// false (and a message) if the blob is damaged or from an incompatible
+// machine, program or base image; the simulator is then left reset
+bool Simulator::restore_checkpoint(const char* data, size_t size)
+{
+    BlobReader r{ data, data + size };
+    CheckpointHeader h, want = checkpoint_header();
+    if (!r.pod(h) || memcmp(h.magic, CKPT_MAGIC, 4) != 0 || h.version != CKPT_VERSION || h.layout != want.layout)
+    {
+        cerr << "Not a checkpoint from this build\n";
+        return false;
+    }
+    if (h.rob_size != want.rob_size || h.num_reg != want.num_reg || memcmp(h.rs_counts, want.rs_counts, sizeof(h.rs_counts)) != 0)
+    {
+        cerr << "Checkpoint was taken with different ROB, RS or register counts\n";
+        return false;
+    }
+    if (h.program_hash != want.program_hash || h.memory_hash != want.memory_hash)
+    {
+        cerr << "Checkpoint was taken with a different program or memory image\n";
+        return false;
+    }
+
+    init_structures();
+    memory_mem.reset();
+    bool ok = r.vec_exact(timing) && r.vec_exact(regs) && r.vec_exact(reg_tag);
+    for (auto& set : RS_sets)
+    {
+        vector<RS> saved;
+        ok = ok && r.vec(saved) && saved.size() == set.size();
+        if (ok)
+            copy(saved.begin(), saved.end(), set.begin()); // keeps rs_by_slot valid
+    }
+    ok = ok && r.vec(ROB) && (int)ROB.size() == cfg.rob_size && r.pod(rob_head) && r.pod(rob_tail) && r.pod(rob_count);
+    for (auto& waiters : rob_waiters)
+        ok = ok && r.vec(waiters);
+    vector<pair<long long, int>> pending;
+    vector<pair<long long, int>> ready;
+    ok = ok && r.vec(start_queue) && r.vec(pending) && r.vec(ready);
+    for (auto& e : pending)
+        exec_done_queue.push(e);
+    write_ready.insert(ready.begin(), ready.end());
+
+    // everything the pipeline indexes with must be in range: a damaged blob
+    // is rejected here rather than followed
+    const int slots = (int)rs_by_slot.size(), instrs = (int)program.size();
+    auto tag_ok = [&](int t) { return t >= -1 && t < cfg.rob_size; };
+    auto slot_ok = [&](int s) { return s >= 0 && s < slots; };
+    auto word_ok = [](int v) { return v == wrap16(v); };
+    ok = ok && rob_head >= 0 && rob_head < cfg.rob_size && rob_tail >= 0 && rob_tail < cfg.rob_size && rob_count >= 0
+        && rob_count <= cfg.rob_size && (rob_head + rob_count) % cfg.rob_size == rob_tail;
+    for (int t : reg_tag)
+        ok = ok && tag_ok(t);
+    for (int v : regs)
+        ok = ok && word_ok(v);
+    // busy entries are indexed into program[] and the opcode tables
+    auto instr_ok = [&](bool busy, int id) { return busy ? id >= 0 && id < instrs : id >= -1 && id < instrs; };
+    for (auto& e : ROB)
+        ok = ok && instr_ok(e.busy, e.instr_id) && (uint8_t)e.type <= (uint8_t)ROBType::HALT && word_ok(e.value);
+    for (RS* rs : rs_by_slot)
+        ok = ok && (!rs->busy || (rs->rob_dest >= 0 && rs->rob_dest < cfg.rob_size && tag_ok(rs->Qj) && tag_ok(rs->Qk)
+            && instr_ok(true, rs->instr_id) && valid_opcode(rs->opcode)));
+    for (auto& waiters : rob_waiters)
+        for (int s : waiters)
+            ok = ok && slot_ok(s);
+    for (int s : start_queue)
+        ok = ok && slot_ok(s);
+    for (auto& e : pending)
+        ok = ok && slot_ok(e.second);
+    for (auto& e : ready)
+        ok = ok && slot_ok(e.second);
+
+    ok = ok && r.pod(PC) && r.pod(fetch_halted) && r.pod(cycle_num) && r.pod(cdb_used) && r.pod(uncommitted_instrs)
+        && r.pod(halted) && r.pod(halted_at) && r.pod(committed_count) && r.pod(branch_count) && r.pod(mispredictions) && r.pod(fast_forwarded);
+    ok = ok && r.vec_exact(latest_committed) && r.vec_exact(latest_seq) && r.pod(next_seq);
+
+    ok = ok && r.vec_exact(branch_info) && r.pod(ghr);
+    uint64_t setup = 0, shadows = 0;
+    vector<char> blob;
+    auto tables = [&](BranchPredictor& p, bool use)
+        {
+            if (!r.vec(blob))
+                return false;
+            BlobReader br{ blob.data(), blob.data() + blob.size() };
+            return !use || (p.load(br) && br.p == br.end);
+        };
+    bool same_bp = r.pod(setup) && setup == predictor_setup();
+    ok = ok && tables(*predictor, same_bp);
+    vector<int> btb_pc, btb_target;
+    ok = ok && r.vec(btb_pc) && r.vec(btb_target) && btb_pc.size() == btb_target.size()
+        && (!same_bp || btb_pc.size() == btb.pc.size());
+    if (ok && same_bp)
+    {
+        btb.pc = btb_pc;
+        btb.target = btb_target;
+    }
+    ok = ok && r.pod(shadows);
+    bool same_shadow = same_bp && shadows == shadow.size();
+    for (uint64_t k = 0; ok && k < shadows; ++k)
+        ok = tables(same_shadow ? *shadow[k] : *predictor, same_shadow);
+    vector<long long> misses;
+    uint64_t shadow_hist = 0;
+    long long branches = 0;
+    ok = ok && r.vec(misses) && r.pod(shadow_hist) && r.pod(branches);
+    if (ok && same_shadow)
+    {
+        shadow_misses = misses;
+        shadow_ghr = shadow_hist;
+    }
+    committed_branches = branches;
+    if (ok && !same_bp)
+        cerr << "Note: checkpoint taken with a different branch predictor setup; predictors start cold\n";
+    // a RAS of another depth starts empty, and so do the copies squashes restore
+    int ras_depth = 0;
+    RAS saved_ras;
+    vector<int> snap;
+    ok = ok && r.pod(ras_depth) && r.vec(saved_ras.addr) && r.pod(saved_ras.top) && r.pod(saved_ras.count) && r.vec(snap)
+        && r.pod(ras_hits) && r.pod(ras_misses);
+    if (ok && ras_depth == cfg.ras_entries)
+    {
+        ok = saved_ras.size() == ras_depth && snap.size() == ras_snap.size() && saved_ras.top >= 0
+            && saved_ras.top < max(1, ras_depth) && saved_ras.count >= 0 && saved_ras.count <= ras_depth;
+        for (auto& bi : branch_info)
+            ok = ok && bi.ras_top >= 0 && bi.ras_top < max(1, ras_depth) && bi.ras_count >= 0 && bi.ras_count <= ras_depth;
+        ras = saved_ras;
+        ras_snap = snap;
+    }
+    else if (ok)
+    {
+        for (auto& bi : branch_info)
+            bi.ras_top = bi.ras_count = 0;
+        if (cfg.ras_entries > 0)
+            cerr << "Note: checkpoint taken with a different RAS depth; the RAS starts empty\n";
+    }
+    // the queue itself is kept whatever cfg.lsq is; a store-set table of
+    // another size starts cold
+    vector<int> order;
+    StoreSets saved_sets;
+    ok = ok && r.vec_exact(lsq) && r.vec(order) && r.vec(saved_sets.ssit) && r.vec(saved_sets.lfst)
+        && r.pod(lsq_loads) && r.pod(lsq_forwarded) && r.pod(lsq_replays) && r.pod(lsq_waits);
+    for (int idx : order)
+        ok = ok && idx >= 0 && idx < cfg.rob_size;
+    for (auto& m : lsq)
+        ok = ok && tag_ok(m.wait_rob);
+    for (int set : saved_sets.ssit)
+        ok = ok && set >= -1 && set < (int)saved_sets.lfst.size();
+    for (auto& last : saved_sets.lfst)
+        ok = ok && tag_ok(last.first);
+    lsq_order.assign(order.begin(), order.end());
+    if (ok && saved_sets.ssit.size() == store_sets.ssit.size() && saved_sets.lfst.size() == store_sets.lfst.size())
+        store_sets = saved_sets;
+    else if (ok && store_sets.enabled())
+        cerr << "Note: checkpoint taken with a different store-set size; the predictor starts cold\n";
+    ok = ok && r.pod(stalls) && r.pod(recovery_seq) && r.pod(last_commit_cycle);
+    vector<CommitRecord> history;
+    ok = ok && r.vec(history);
+    for (auto& rec : history)
+    {
+        ok = ok && rec.prog_idx >= 0 && rec.prog_idx < instrs;
+        committed_log.push(rec);
+    }
+
+    uint64_t pages = 0;
+    ok = ok && r.pod(pages);
+    for (uint64_t i = 0; ok && i < pages; ++i)
+    {
+        int page;
+        ok = r.pod(page) && page >= 0 && page < MEM_PAGES && (size_t)(r.end - r.p) >= MEM_PAGE_WORDS * sizeof(uint16_t);
+        if (ok)
+        {
+            memory_mem.restore_page(page, (const uint16_t*)r.p);
+            r.p += MEM_PAGE_WORDS * sizeof(uint16_t);
+        }
+    }
+    if (!ok || r.p != r.end)
+    {
+        cerr << "Corrupt checkpoint\n";
+        memory_mem.reset();
+        init_structures();
+        return false;
+    }
+    rebuild_squash_links();
+    return true;
+}
+
+bool Simulator::save_checkpoint_file(const string& fname) const
+{
+    string blob;
+    save_checkpoint(blob);
+    ofstream f(fname, ios::binary);
+    if (!f.write(blob.data(), blob.size()))
+    {
+        cerr << "Cannot write checkpoint: " << fname << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool Simulator::restore_checkpoint_file(const string& fname)
+{
+    MappedFile f;
+    if (!f.open(fname))
+    {
+        cerr << "Cannot open checkpoint: " << fname << "\n";
+        return false;
+    }
+    return restore_checkpoint(f.data, f.size);
+}
+
+// ---------------- Reporting ----------------
+void Simulator::print_report() const
+{
+    cout << "\n===== Simulation Results =====\n";
+    cout << "Cycles: " << cycle_num << "\n";
+    long long committed = committed_count;
+    double ipc = (cycle_num > 0) ? (double)committed / cycle_num : 0.0;
+    cout << fixed << setprecision(3) << "IPC: " << ipc << "\n";
+    cout << "Instructions (executions): " << committed << "\n";
+    cout << "Branches: " << branch_count << "  Mispredictions: " << mispredictions << "\n";
+    if (cfg.bp != BPKind::NOT_TAKEN || cfg.resolve_at_write || cfg.bp_compare)
+    {
+        // MPKI: mispredictions per thousand committed instructions
+        auto mpki = [&](long long misses) { return committed ? 1000.0 * misses / committed : 0.0; };
+        cout << "Branch predictor: " << BP_NAMES[(int)cfg.bp] << " (" << cfg.bp_entries << " entries, BTB "
+            << cfg.btb_entries << "), resolved at " << (cfg.resolve_at_write ? "write" : "commit")
+            << "  MPKI: " << mpki(mispredictions) << "\n";
+        if (!shadow.empty())
+        {
+            cout << "Predictor comparison over " << committed_branches << " committed branches:\n";
+            for (size_t k = 0; k < shadow.size(); ++k)
+                cout << "  " << left << setw(12) << BP_NAMES[k] << "mispredictions " << setw(10) << shadow_misses[k]
+                    << "MPKI " << mpki(shadow_misses[k]) << "\n";
+        }
+    }
+    if (cfg.lsq)
+    {
+        cout << "LSQ: loads " << lsq_loads << "  forwarded " << lsq_forwarded << " ("
+            << (lsq_loads ? 100.0 * lsq_forwarded / lsq_loads : 0.0) << "%)  replays " << lsq_replays;
+        if (store_sets.enabled())
+            cout << "  store-set waits " << lsq_waits << " (" << cfg.storeset_entries << " entries)";
+        cout << "\n";
+    }
+    if (cfg.ras_entries > 0)
+        cout << "Return address stack: " << cfg.ras_entries << " entries  Hits: " << ras_hits << "  Misses: " << ras_misses << "\n";
+    if (halted)
+        cout << "Halted at PC " << halted_at << "\n";
+    if (fast_forwarded > 0)
+        cout << "Fast-forwarded (not timed): " << fast_forwarded << "\n";
+    if (committed > (long long)committed_log.buf.size())
+        cout << "(showing the last " << committed_log.buf.size() << " executions)\n";
+    cout << "\n";
+
+    // the ID column grows for long runs
+    int id_w = max<int>(5, (int)to_string(committed).size() + 1);
+    cout << left << setw(id_w) << "ID" << setw(8) << "ADDR" << setw(8) << "OP" << setw(22) << "TEXT"
+        << setw(8) << "Issue" << setw(10) << "ExecS" << setw(10) << "ExecE" << setw(8) << "Write" << setw(8) << "Commit" << "\n";
+    committed_log.for_each([&](const CommitRecord& r)
+        {
+            const Instr& ins = program[r.prog_idx];
+            const char* opname = opcode_name(ins.opcode);
+            string text = ins.text.empty() ? to_string(ins.opcode) + " " + to_string(ins.rd) + " " + to_string(ins.rs1) + " " + to_string(ins.rs2_imm)
+                                           : string(ins.text);
+            cout << setw(id_w) << r.seq << setw(8) << r.addr << setw(8) << opname << setw(22) << text;
+            auto f = [](long long x) -> string
+                { return x == -1 ? string("-") : to_string(x); };
+            cout << setw(8) << f(r.issue) << setw(10) << f(r.exec_start) << setw(10) << f(r.exec_end)
+                << setw(8) << f(r.write) << setw(8) << f(r.commit) << "\n";
+        });
+    cout << "\nFinal registers (R0..R" << cfg.num_reg - 1 << "):\n";
+    for (int i = 0; i < cfg.num_reg; ++i)
+        cout << "R" << i << ":" << wrap16(regs[i]) << (i == cfg.num_reg - 1 ? "\n" : "  ");
+    cout << "\nMemory nonzero values (first 256 addresses):\n";
+    int printed = 0;
+    memory_mem.for_each_nonzero([&](int addr, int v)
+        {
+            if (addr >= 256)
+                return;
+            cout << "[" << addr << "]=" << v << "  ";
+            if (++printed % 8 == 0)
+                cout << "\n";
+        });
+    if (printed == 0)
+        cout << "(none)\n";
+}
+
+// --cpi-stack: where the cycles and issue slots went. The cycle stack is in
+// cycles per committed instruction, so its rows add up to the run's CPI; the
+// per-family table splits it by the family at the ROB head.
+void Simulator::print_cpi_stack() const
+{
+    // the cycles since the last commit, and the slots of instructions still in
+    // flight, are only charged at commit
+    StallCounters counts = stalls;
+    count_stall_cycles(counts, rob_count > 0 ? rob_head : -1, last_commit_cycle + 1, cycle_num + 1);
+    for (int i = rob_head, n = 0; n < rob_count; i = (i + 1) % cfg.rob_size, ++n)
+        counts.slot((int)program[ROB[i].instr_id].uop.family, SlotUse::ISSUED);
+
+    long long total_cycles = 0, total_slots = 0;
+    long long cycles[NUM_CYCLE_CAUSES] = {}, slots[NUM_SLOT_USES] = {};
+    for (int f = 0; f <= NUM_RS_FAMILIES; ++f)
+    {
+        for (int c = 0; c < NUM_CYCLE_CAUSES; ++c)
+        {
+            cycles[c] += counts.cycles[f][c];
+            total_cycles += counts.cycles[f][c];
+        }
+        for (int u = 0; u < NUM_SLOT_USES; ++u)
+        {
+            slots[u] += counts.slots[f][u];
+            total_slots += counts.slots[f][u];
+        }
+    }
+    auto cpi = [&](long long n) { return committed_count ? (double)n / committed_count : 0.0; };
+    auto pct = [](long long n, long long total) { return total ? 100.0 * n / total : 0.0; };
+
+    cout << "\n===== CPI Stack =====\n";
+    cout << fixed << setprecision(3) << "Cycles: " << total_cycles << "  Instructions: " << committed_count
+        << "  CPI: " << cpi(total_cycles) << "\n";
+    for (int c = 0; c < NUM_CYCLE_CAUSES; ++c)
+        cout << "  " << left << setw(13) << CYCLE_CAUSE_NAMES[c] << right << setw(14) << cycles[c] << setw(12) << cpi(cycles[c])
+            << setprecision(1) << setw(8) << pct(cycles[c], total_cycles) << "%\n" << setprecision(3);
+    cout << "Issue slots: " << total_slots << "\n";
+    for (int u = 0; u < NUM_SLOT_USES; ++u)
+        cout << "  " << left << setw(13) << SLOT_USE_NAMES[u] << right << setw(14) << slots[u]
+            << setprecision(1) << setw(20) << pct(slots[u], total_slots) << "%\n" << setprecision(3);
+
+    cout << "\nPer RS family (CPI by the family at the ROB head; issue slots by the family at fetch):\n";
+    cout << left << setw(7) << "FAMILY" << right;
+    for (int c = 0; c < NUM_CYCLE_CAUSES; ++c)
+        cout << setw(12) << CYCLE_CAUSE_NAMES[c];
+    cout << "  |";
+    for (int u = 0; u < NUM_SLOT_USES; ++u)
+        cout << setw(11) << SLOT_USE_NAMES[u];
+    cout << "\n";
+    for (int f = 0; f <= NUM_RS_FAMILIES; ++f)
+    {
+        cout << left << setw(7) << (f < NUM_RS_FAMILIES ? RS_FAMILY_NAMES[f] : "-") << right;
+        for (int c = 0; c < NUM_CYCLE_CAUSES; ++c)
+            cout << " " << setw(11) << cpi(counts.cycles[f][c]);
+        cout << "  |";
+        for (int u = 0; u < NUM_SLOT_USES; ++u)
+            cout << " " << setw(10) << counts.slots[f][u];
+        cout << "\n";
+    }
+}
+
+void Simulator::start_profile()
+{
+    profile = make_unique<HostProfile>();
+    select_step();
+    profile->start(cycle_num, committed_count);
+}
+
+void Simulator::stop_profile()
+{
+    profile->stop(cycle_num, committed_count);
+}
+
+// --profile: host throughput between start_profile and stop_profile, the
+// stage breakdown scaled up from the sampled steps, and hardware counters
+void Simulator::print_profile() const
+{
+    const HostProfile& p = *profile;
+    double secs = chrono::duration<double>(p.wall_stop - p.wall_start).count();
+    long long cycles = p.cycles_stop - p.cycles_start;
+    long long committed = p.committed_stop - p.committed_start;
+    auto per_second = [&](long long n) { return secs > 0 ? n / secs / 1e6 : 0.0; };
+    auto per = [](double x, long long n) { return n ? x / n : 0.0; };
+
+    cout << "\n===== Host Profile =====\n";
+    cout << fixed << setprecision(3) << "Host time: " << secs << " s  Cycles: " << cycles << "  Instructions: " << committed << "\n";
+    cout << setprecision(2) << "Throughput: " << per_second(cycles) << " M cycles/s  " << per_second(committed)
+        << " M instructions/s  " << setprecision(1) << per(secs * 1e9, cycles) << " ns/cycle\n";
+    if (!PROFILE_PROBES)
+        cout << "Stages: probes compiled out (TOMASULO_NO_PROFILE)\n";
+    else if (p.sampled_steps > 0)
+    {
+        // shares of the timed steps, applied to the whole run (which also holds
+        // the main loop, idle-cycle skipping and checkpoints)
+        uint64_t timed = accumulate(p.ticks, p.ticks + NUM_HOST_STAGES, (uint64_t)0);
+        cout << "Stages (" << p.sampled_steps << " steps timed):\n";
+        for (int s = 0; s < NUM_HOST_STAGES; ++s)
+        {
+            double share = timed ? (double)p.ticks[s] / timed : 0.0;
+            cout << "  " << left << setw(14) << HOST_STAGE_NAMES[s] << right << setw(7) << 100 * share << "%"
+                << setw(10) << per(share * secs * 1e9, cycles) << " ns/cycle\n";
+        }
+    }
+    if (!p.perf.any())
+        cout << "Hardware counters: unavailable (" << p.perf.error << ")\n";
+    else
+    {
+        cout << "Hardware counters:\n";
+        for (int i = 0; i < PerfCounters::N; ++i)
+            if (p.perf.fd[i] != -1)
+                cout << "  " << left << setw(14) << PerfCounters::NAMES[i] << right << setw(16) << p.perf.value[i]
+                    << setprecision(2) << setw(12) << per((double)p.perf.value[i], cycles) << " per cycle\n";
+    }
+}
+
+// ---------------- Trace reader ----------------
+// Print a commit trace as the report table, or as CSV. The program file is
+// optional and only supplies the TEXT column.
+bool read_trace(const string& fname, bool csv, const Program* prog)
+{
+    MappedFile f;
+    TraceFileHeader h;
+    if (!f.open(fname) || f.size < sizeof(h))
+    {
+        cerr << "Cannot open trace: " << fname << "\n";
+        return false;
+    }
+    memcpy(&h, f.data, sizeof(h));
+    if (memcmp(h.magic, TRACE_MAGIC, 4) != 0 || h.version != TRACE_VERSION || h.record_size != sizeof(TraceRecord))
+    {
+        cerr << "Bad trace header: " << fname << "\n";
+        return false;
+    }
+    auto text_of = [prog](const TraceRecord& r) -> string
+        {
+            int idx = prog ? r.addr - prog->start_pc : -1;
+            if (idx < 0 || idx >= (int)prog->instrs.size() || prog->instrs[idx].opcode != r.opcode)
+                return "-";
+            const Instr& ins = prog->instrs[idx];
+            return ins.text.empty() ? to_string(ins.opcode) + " " + to_string(ins.rd) + " " + to_string(ins.rs1) + " " + to_string(ins.rs2_imm)
+                                    : string(ins.text);
+        };
+    if (csv)
+        cout << "id,addr,op,text,issue,exec_start,exec_end,write,commit\n";
+    else
+        cout << left << setw(12) << "ID" << setw(8) << "ADDR" << setw(8) << "OP" << setw(22) << "TEXT"
+            << setw(8) << "Issue" << setw(10) << "ExecS" << setw(10) << "ExecE" << setw(8) << "Write" << setw(8) << "Commit" << "\n";
+
+    const char* p = f.data + sizeof(h);
+    const char* end = f.data + f.size;
+    vector<TraceRecord> recs;
+    while (p < end)
+    {
+        uint32_t hdr[2];
+        if (end - p < (ptrdiff_t)sizeof(hdr))
+            break;
+        memcpy(hdr, p, sizeof(hdr));
+        p += sizeof(hdr);
+        if ((size_t)(end - p) < hdr[1] || !decode_trace_block(p, p + hdr[1], hdr[0], recs))
+        {
+            cerr << "Corrupt trace block in " << fname << "\n";
+            return false;
+        }
+        p += hdr[1];
+        for (auto& r : recs)
+        {
+            if (csv)
+            {
+                auto c = [](int64_t x) { return x == -1 ? string() : to_string(x); };
+                cout << r.seq << "," << r.addr << "," << opcode_name(r.opcode) << "," << csv_quoted(text_of(r)) << ","
+                    << c(r.issue) << "," << c(r.exec_start) << "," << c(r.exec_end) << "," << c(r.write) << "," << c(r.commit) << "\n";
+            }
+            else
+            {
+                auto t = [](int64_t x) { return x == -1 ? string("-") : to_string(x); };
+                cout << setw(12) << r.seq << setw(8) << r.addr << setw(8) << opcode_name(r.opcode) << setw(22) << text_of(r)
+                    << setw(8) << t(r.issue) << setw(10) << t(r.exec_start) << setw(10) << t(r.exec_end)
+                    << setw(8) << t(r.write) << setw(8) << t(r.commit) << "\n";
+            }
+        }
+    }
+    if (p != end)
+    {
+        cerr << "Truncated trace: " << fname << "\n";
+        return false;
+    }
+    return true;
+}
+
+// ---------------- Sweep ----------------
+// Design-space sweep: every combination of a parameter grid on every
+// program, each run on its own Simulator. Programs and memory images are
+// loaded once and shared read-only by all runs.
+//
+// Grid file, '#' or '//' starts a comment:
+//   rob_size = 4, 8, 16        any config key, one or more values
+//   rs.ADD = 2, 4
+//   program = loop.txt, loop_mem.txt   (memory file optional)
+
+// Work-stealing pool: every worker owns a deque of task indices, runs its own
+// newest task and steals the oldest task of another worker once it runs dry
+class WorkStealingPool
+{
+public:
+    explicit WorkStealingPool(unsigned threads) : queues(max(1u, threads)) {}
+
+    // fn(task) for every task in [0, count); returns when all have run
+    void run(size_t count, const function<void(size_t)>& fn)
+    {
+        for (size_t t = 0; t < count; ++t)
+            queues[t % queues.size()].tasks.push_back(t);
+        vector<thread> workers;
+        for (size_t w = 0; w < queues.size(); ++w)
+            workers.emplace_back([this, w, &fn]
+                {
+                    size_t task;
+                    while (pop(w, task) || steal(w, task))
+                        fn(task);
+                });
+        for (auto& t : workers)
+            t.join();
+    }
+
+private:
+    struct Queue
+    {
+        mutex m;
+        deque<size_t> tasks;
+    };
+
+    bool pop(size_t w, size_t& task)
+    {
+        lock_guard<mutex> lock(queues[w].m);
+        if (queues[w].tasks.empty())
+            return false;
+        task = queues[w].tasks.back();
+        queues[w].tasks.pop_back();
+        return true;
+    }
+
+    // no task is ever added after run() starts, so finding every queue
+    // empty means the sweep is done
+    bool steal(size_t w, size_t& task)
+    {
+        for (size_t i = 1; i < queues.size(); ++i)
+        {
+            Queue& q = queues[(w + i) % queues.size()];
+            lock_guard<mutex> lock(q.m);
+            if (!q.tasks.empty())
+            {
+                task = q.tasks.front();
+                q.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    vector<Queue> queues;
+};
+
+struct SweepAxis
+{
+    string key;
+    vector<string> values;
+};
+
+struct SweepInput
+{
+    string prog_file, mem_file;
+    shared_ptr<const Program> prog;
+    shared_ptr<const MemoryImage> mem;
+};
+
+struct SweepResult
+{
+    int point = 0; // grid point (index into the expanded configs)
+    int input = 0; // program
+    long long cycles = 0, committed = 0, branches = 0, mispredictions = 0;
+    bool halted = false;
+    int cost = 0; // hardware cost: ROB entries + RS entries
+    bool pareto = false;
+
+    // IPC rather than cycles, so runs cut off by --max-cycles still compare
+    double ipc() const { return cycles > 0 ? (double)committed / cycles : 0.0; }
+};
+
+struct SweepOptions
+{
+    long long max_cycles = DEFAULT_MAX_CYCLES;
+    long long max_commits = DEFAULT_MAX_COMMITS;
+    bool event_driven = false;
+    int halt_pc = -1;
+    unsigned threads = 0; // 0 = one per hardware thread
+    string out = "sweep.csv";
+};
+
+bool load_sweep_grid(const string& fname, vector<SweepAxis>& axes, vector<SweepInput>& inputs)
+{
+    ifstream f(fname);
+    if (!f)
+    {
+        cerr << "Cannot open sweep grid: " << fname << "\n";
+        return false;
+    }
+    auto trim = [](const string& s)
+        {
+            size_t b = s.find_first_not_of(" \t\r"), e = s.find_last_not_of(" \t\r");
+            return b == string::npos ? string() : s.substr(b, e - b + 1);
+        };
+    string line;
+    while (getline(f, line))
+    {
+        for (const char* marker : { "#", "//" })
+            if (line.find(marker) != string::npos)
+                line.erase(line.find(marker));
+        line = trim(line);
+        if (line.empty())
+            continue;
+        size_t eq = line.find('=');
+        if (eq == string::npos)
+        {
+            cerr << "Sweep grid line needs key = values: " << line << "\n";
+            return false;
+        }
+        string key = trim(line.substr(0, eq));
+        vector<string> values;
+        stringstream ss(line.substr(eq + 1));
+        for (string v; getline(ss, v, ',');)
+            values.push_back(trim(v));
+        if (key == "program")
+        {
+            if (values.empty() || values.size() > 2 || values[0].empty())
+            {
+                cerr << "Sweep grid: program = file[, memory file]\n";
+                return false;
+            }
+            inputs.push_back({ values[0], values.size() > 1 ? values[1] : string(), nullptr, nullptr });
+            continue;
+        }
+        if (key == "num_reg")
+        {
+            cerr << "num_reg cannot be swept: programs are decoded once for all runs\n";
+            return false;
+        }
+        // check every value now rather than in the middle of the sweep
+        MachineConfig scratch = cfg;
+        for (auto& v : values)
+            if (!apply_config_setting(scratch, key, v))
+                return false;
+        axes.push_back({ key, values });
+    }
+    if (inputs.empty())
+    {
+        cerr << "Sweep grid has no program lines\n";
+        return false;
+    }
+    return true;
+}
+
+// mark, per program, the runs no other run beats on both IPC and cost
+void mark_pareto(vector<SweepResult>& results)
+{
+    vector<SweepResult*> order;
+    for (auto& r : results)
+        order.push_back(&r);
+    stable_sort(order.begin(), order.end(), [](const SweepResult* a, const SweepResult* b)
+        {
+            if (a->input != b->input)
+                return a->input < b->input;
+            if (a->cost != b->cost)
+                return a->cost < b->cost;
+            return a->ipc() > b->ipc();
+        });
+    double best = -1.0;
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        if (i == 0 || order[i]->input != order[i - 1]->input)
+            best = -1.0;
+        // equal cost and IPC: only the first (lowest grid point) is kept
+        order[i]->pareto = order[i]->ipc() > best;
+        best = max(best, order[i]->ipc());
+    }
+}
+
+bool write_sweep_results(const string& fname, const vector<SweepAxis>& axes, const vector<vector<string>>& points,
+    const vector<SweepInput>& inputs, const vector<SweepResult>& results)
+{
+    ofstream f(fname);
+    if (!f)
+    {
+        cerr << "Cannot write sweep results: " << fname << "\n";
+        return false;
+    }
+    bool json = fname.size() >= 5 && fname.compare(fname.size() - 5, 5, ".json") == 0;
+    // integer axis values are written bare; anything else (bp = gshare) is a string
+    auto numeric = [](const string& s)
+        {
+            long long v;
+            auto r = from_chars(s.data(), s.data() + s.size(), v);
+            return r.ec == errc() && r.ptr == s.data() + s.size() && to_string(v) == s;
+        };
+    if (json)
+        f << "[\n";
+    else
+    {
+        f << "program,memory";
+        for (auto& a : axes)
+            f << "," << a.key;
+        f << ",cycles,committed,ipc,branches,mispredictions,halted,cost,pareto\n";
+    }
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const SweepResult& r = results[i];
+        const SweepInput& in = inputs[r.input];
+        double ipc = r.ipc();
+        if (json)
+        {
+            f << "  {\"program\": " << json_quoted(in.prog_file) << ", \"memory\": " << json_quoted(in.mem_file);
+            for (size_t a = 0; a < axes.size(); ++a)
+            {
+                const string& v = points[r.point][a];
+                f << ", " << json_quoted(axes[a].key) << ": " << (numeric(v) ? v : json_quoted(v));
+            }
+            f << ", \"cycles\": " << r.cycles << ", \"committed\": " << r.committed << ", \"ipc\": " << fixed << setprecision(4) << ipc
+                << ", \"branches\": " << r.branches << ", \"mispredictions\": " << r.mispredictions
+                << ", \"halted\": " << (r.halted ? "true" : "false") << ", \"cost\": " << r.cost
+                << ", \"pareto\": " << (r.pareto ? "true" : "false") << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        else
+        {
+            f << csv_quoted(in.prog_file) << "," << csv_quoted(in.mem_file);
+            for (auto& v : points[r.point])
+                f << "," << (numeric(v) ? v : csv_quoted(v));
+            f << "," << r.cycles << "," << r.committed << "," << fixed << setprecision(4) << ipc << "," << r.branches
+                << "," << r.mispredictions << "," << r.halted << "," << r.cost << "," << r.pareto << "\n";
+        }
+    }
+    if (json)
+        f << "]\n";
+    return (bool)f;
+}
+
+bool run_sweep(const string& grid_file, const SweepOptions& opt)
+{
+    vector<SweepAxis> axes;
+    vector<SweepInput> inputs;
+    if (!load_sweep_grid(grid_file, axes, inputs))
+        return false;
+    for (auto& in : inputs)
+    {
+        auto prog = make_shared<Program>();
+        prog->num_reg = cfg.num_reg;
+        if (!load_program(in.prog_file, *prog))
+        {
+            cerr << "Failed to load program file: " << in.prog_file << "\n";
+            return false;
+        }
+        in.prog = prog;
+        if (!in.mem_file.empty() && !load_memory(in.mem_file, in.mem))
+            cerr << "Warning: Could not open memory file: " << in.mem_file << "\n";
+    }
+
+    // expand the grid, first axis varying slowest
+    vector<vector<string>> points(1);
+    for (auto& a : axes)
+    {
+        vector<vector<string>> next;
+        for (auto& p : points)
+            for (auto& v : a.values)
+            {
+                next.push_back(p);
+                next.back().push_back(v);
+            }
+        points = move(next);
+    }
+    vector<MachineConfig> configs;
+    for (auto& p : points)
+    {
+        MachineConfig c = cfg;
+        for (size_t a = 0; a < axes.size(); ++a)
+            apply_config_setting(c, axes[a].key, p[a]);
+        if (!validate_config(c))
+            return false;
+        configs.push_back(c);
+    }
+
+    vector<SweepResult> results(points.size() * inputs.size());
+    unsigned threads = opt.threads ? opt.threads : max(1u, thread::hardware_concurrency());
+    cerr << "Sweeping " << points.size() << " configurations x " << inputs.size() << " programs on " << threads << " threads\n";
+    auto t0 = chrono::steady_clock::now();
+    WorkStealingPool(threads).run(results.size(), [&](size_t task)
+        {
+            SweepResult& r = results[task];
+            r.point = (int)(task / inputs.size());
+            r.input = (int)(task % inputs.size());
+            const MachineConfig& c = configs[r.point];
+            Simulator sim(c, inputs[r.input].prog, inputs[r.input].mem);
+            sim.event_driven = opt.event_driven;
+            sim.halt_pc = opt.halt_pc;
+            sim.committed_log.capacity = 0; // no report: keep no history
+            sim.init_structures();
+            sim.run(opt.max_cycles, opt.max_commits);
+            r.cycles = sim.cycle_num;
+            r.committed = sim.committed_count;
+            r.branches = sim.branch_count;
+            r.mispredictions = sim.mispredictions;
+            r.halted = sim.halted;
+            r.cost = c.rob_size + accumulate(c.rs_counts, c.rs_counts + NUM_RS_FAMILIES, 0);
+        });
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    mark_pareto(results);
+    if (!write_sweep_results(opt.out, axes, points, inputs, results))
+        return false;
+
+    cout << "Ran " << results.size() << " simulations in " << fixed << setprecision(2) << secs << " s, results in " << opt.out << "\n";
+    cout << "\n===== Pareto front (IPC vs ROB + RS entries) =====\n";
+    for (size_t in = 0; in < inputs.size(); ++in)
+    {
+        cout << inputs[in].prog_file << "\n";
+        vector<const SweepResult*> front;
+        for (auto& r : results)
+            if (r.input == (int)in && r.pareto)
+                front.push_back(&r);
+        sort(front.begin(), front.end(), [](const SweepResult* a, const SweepResult* b) { return a->cost < b->cost; });
+        for (auto* r : front)
+        {
+            cout << "  cost " << setw(4) << r->cost << "  cycles " << setw(10) << r->cycles << "  IPC " << setprecision(3)
+                << r->ipc() << " ";
+            for (size_t a = 0; a < axes.size(); ++a)
+                cout << " " << axes[a].key << "=" << points[r->point][a];
+            cout << "\n";
+        }
+    }
+    return true;
+}
+
+// ---------------- SimPoint ----------------
+// Representative-interval selection. A functional pass records a basic-block
+// vector (instructions executed per block) for every fixed-length interval,
+// projected down to BBV_DIMS random dimensions. k-means groups the intervals
+// into phases; one interval per phase, weighted by the phase's share of the
+// run, is then simulated in detail from a checkpoint and the weighted CPI
+// stands in for the whole program.
+const int BBV_DIMS = 15; // as in SimPoint
+typedef array<double, BBV_DIMS> BBVPoint;
+
+// block id of every instruction: blocks start at the program start, after
+// BEQ/CALL/RET/HALT, and at BEQ/CALL targets
+vector<int> basic_block_ids(const vector<Instr>& program, int start_pc, int& count)
+{
+    int n = (int)program.size();
+    vector<char> leader(n + 1, 0);
+    leader[0] = 1;
+    for (int i = 0; i < n; ++i)
+    {
+        const MicroOp& u = program[i].uop;
+        if (u.op == Op::BEQ || u.op == Op::CALL || u.op == Op::RET || u.op == Op::HALT)
+            leader[i + 1] = 1;
+        if ((u.op == Op::BEQ || u.op == Op::CALL) && u.target - start_pc >= 0 && u.target - start_pc < n)
+            leader[u.target - start_pc] = 1;
+    }
+    vector<int> ids(n);
+    count = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        if (leader[i])
+            ++count;
+        ids[i] = count - 1;
+    }
+    return ids;
+}
+
+uint64_t splitmix64(uint64_t x)
+{
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+// fixed random projection matrix entry in [-1, 1), computed on demand so
+// huge programs need no matrix
+double bbv_projection(int block, int d)
+{
+    return (splitmix64((uint64_t)block * BBV_DIMS + d) >> 11) * (2.0 / 9007199254740992.0) - 1.0;
+}
+
+struct BBVProfile
+{
+    vector<BBVPoint> points; // one per full interval
+    long long instructions = 0;
+};
+
+// functional pass over the whole run (up to max_instrs, 0 = no cap) from sim's current state
+BBVProfile profile_bbv(Simulator& sim, long long interval, long long max_instrs)
+{
+    int num_blocks = 0;
+    vector<int> block_of = basic_block_ids(sim.program, sim.startPC, num_blocks);
+    vector<long long> counts(num_blocks, 0);
+    vector<int> touched;
+    BBVProfile prof;
+    for (;;)
+    {
+        long long want = max_instrs ? min(interval, max_instrs - prof.instructions) : interval;
+        if (want <= 0)
+            break;
+        long long done = sim.interpret(want, [&](int idx)
+            {
+                int b = block_of[idx];
+                if (counts[b]++ == 0)
+                    touched.push_back(b);
+            });
+        prof.instructions += done;
+        if (done == interval)
+        {
+            // frequency vector (normalised to the interval), then projected
+            BBVPoint p{};
+            for (int b : touched)
+            {
+                double f = (double)counts[b] / interval;
+                for (int d = 0; d < BBV_DIMS; ++d)
+                    p[d] += f * bbv_projection(b, d);
+            }
+            prof.points.push_back(p);
+        }
+        for (int b : touched)
+            counts[b] = 0;
+        touched.clear();
+        if (done < want)
+            break; // halted or left the program
+    }
+    return prof;
+}
+
+double dist2(const BBVPoint& a, const BBVPoint& b)
+{
+    double s = 0;
+    for (int d = 0; d < BBV_DIMS; ++d)
+        s += (a[d] - b[d]) * (a[d] - b[d]);
+    return s;
+}
+
+struct Clustering
+{
+    int k = 0;
+    vector<int> assign;
+    vector<BBVPoint> centers;
+    double distortion = 0; // sum of squared distances to the centers
+};
+
+// Lloyd's algorithm from a k-means++ seeding
+Clustering kmeans(const vector<BBVPoint>& pts, int k, mt19937_64& rng)
+{
+    size_t n = pts.size();
+    Clustering c;
+    c.k = k;
+    c.centers.push_back(pts[rng() % n]);
+    vector<double> d2(n);
+    while ((int)c.centers.size() < k)
+    {
+        double total = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            d2[i] = DBL_MAX;
+            for (auto& ctr : c.centers)
+                d2[i] = min(d2[i], dist2(pts[i], ctr));
+            total += d2[i];
+        }
+        double r = uniform_real_distribution<double>(0, total)(rng);
+        size_t pick = 0;
+        while (pick + 1 < n && (r -= d2[pick]) > 0)
+            ++pick;
+        c.centers.push_back(pts[pick]);
+    }
+
+    c.assign.assign(n, -1);
+    for (int iter = 0; iter < 100; ++iter)
+    {
+        bool changed = false;
+        for (size_t i = 0; i < n; ++i)
+        {
+            int best = 0;
+            for (int j = 1; j < k; ++j)
+                if (dist2(pts[i], c.centers[j]) < dist2(pts[i], c.centers[best]))
+                    best = j;
+            if (c.assign[i] != best)
+            {
+                c.assign[i] = best;
+                changed = true;
+            }
+        }
+        if (!changed)
+            break;
+        vector<BBVPoint> sum(k, BBVPoint{});
+        vector<int> size(k, 0);
+        for (size_t i = 0; i < n; ++i)
+        {
+            ++size[c.assign[i]];
+            for (int d = 0; d < BBV_DIMS; ++d)
+                sum[c.assign[i]][d] += pts[i][d];
+        }
+        for (int j = 0; j < k; ++j)
+            if (size[j] > 0)
+                for (int d = 0; d < BBV_DIMS; ++d)
+                    c.centers[j][d] = sum[j][d] / size[j];
+    }
+    c.distortion = 0;
+    for (size_t i = 0; i < n; ++i)
+        c.distortion += dist2(pts[i], c.centers[c.assign[i]]);
+    return c;
+}
+
+// Bayesian information criterion of a clustering under a spherical Gaussian
+// model (the X-means score SimPoint uses); higher is better
+double bic(const vector<BBVPoint>& pts, const Clustering& c)
+{
+    double R = (double)pts.size(), K = c.k, d = BBV_DIMS;
+    if (R <= K)
+        return -DBL_MAX;
+    double var = max(c.distortion / (R - K) / d, 1e-12);
+    vector<double> size(c.k, 0);
+    for (int a : c.assign)
+        ++size[a];
+    double l = 0;
+    for (double n : size)
+        if (n > 0)
+            l += n * log(n) - n * log(R) - n / 2 * log(4 * acos(0.0) * var) * d - (n - K) / 2;
+    double params = (K - 1) + K * d + 1;
+    return l - params / 2 * log(R);
+}
+
+// best of several seedings for each k <= max_k, then the smallest k whose
+// BIC reaches 90% of the observed BIC range
+Clustering choose_clustering(const vector<BBVPoint>& pts, int max_k)
+{
+    mt19937_64 rng(1);
+    vector<Clustering> by_k;
+    vector<double> score;
+    for (int k = 1; k <= min<int>(max_k, (int)pts.size()); ++k)
+    {
+        Clustering best;
+        for (int seed = 0; seed < 5; ++seed)
+        {
+            Clustering c = kmeans(pts, k, rng);
+            if (seed == 0 || c.distortion < best.distortion)
+                best = move(c);
+        }
+        score.push_back(bic(pts, best));
+        by_k.push_back(move(best));
+    }
+    double lo = *min_element(score.begin(), score.end()), hi = *max_element(score.begin(), score.end());
+    for (size_t i = 0; i < by_k.size(); ++i)
+        if (score[i] >= lo + 0.9 * (hi - lo))
+            return by_k[i];
+    return by_k.back();
+}
+
+struct SimPointOptions
+{
+    long long interval = 0;
+    int max_k = 0;
+    long long warmup = 0;       // detailed instructions before each measured interval
+    long long max_cycles = DEFAULT_MAX_CYCLES; // per detailed interval
+    long long max_instrs = 0;   // functional pass cap, 0 = whole run
+    bool event_driven = false;
+    int halt_pc = -1;
+    unsigned threads = 0;       // 0 = one per hardware thread
+    string out;                 // simpoints file, empty = none
+};
+
+struct SimPoint
+{
+    int cluster = 0;
+    long long interval = 0; // index; starts at interval * length
+    long long members = 0;
+    double weight = 0;
+    double cpi = 0;
+};
+
+bool run_simpoint(shared_ptr<const Program> prog, shared_ptr<const MemoryImage> mem, const SimPointOptions& opt)
+{
+    auto make_sim = [&]
+        {
+            auto sim = make_unique<Simulator>(cfg, prog, mem);
+            sim->event_driven = opt.event_driven;
+            sim->halt_pc = opt.halt_pc;
+            sim->committed_log.capacity = 0;
+            sim->init_structures();
+            return sim;
+        };
+
+    // 1. functional profile and clustering
+    auto sim = make_sim();
+    BBVProfile prof = profile_bbv(*sim, opt.interval, opt.max_instrs);
+    if (prof.points.empty())
+    {
+        cerr << "Run too short for one interval of " << opt.interval << " instructions (" << prof.instructions << " executed)\n";
+        return false;
+    }
+    Clustering c = choose_clustering(prof.points, opt.max_k);
+
+    // 2. one representative per cluster: the interval closest to its center
+    vector<SimPoint> points(c.k);
+    vector<double> best(c.k, DBL_MAX);
+    for (size_t i = 0; i < prof.points.size(); ++i)
+    {
+        SimPoint& sp = points[c.assign[i]];
+        ++sp.members;
+        double d = dist2(prof.points[i], c.centers[c.assign[i]]);
+        if (d < best[c.assign[i]])
+        {
+            best[c.assign[i]] = d;
+            sp.interval = (long long)i;
+        }
+    }
+    points.erase(remove_if(points.begin(), points.end(), [](const SimPoint& sp) { return sp.members == 0; }), points.end());
+    for (size_t j = 0; j < points.size(); ++j)
+    {
+        points[j].cluster = (int)j;
+        points[j].weight = (double)points[j].members / prof.points.size();
+    }
+    sort(points.begin(), points.end(), [](const SimPoint& a, const SimPoint& b) { return a.interval < b.interval; });
+
+    // 3. checkpoints at each representative (less its warm-up), in one more functional pass
+    vector<string> checkpoints(points.size());
+    vector<long long> warmups(points.size());
+    sim->memory_mem.reset();
+    sim->init_structures();
+    for (size_t j = 0; j < points.size(); ++j)
+    {
+        long long start = points[j].interval * opt.interval;
+        warmups[j] = min(opt.warmup, start);
+        sim->fast_forward(start - warmups[j] - sim->fast_forwarded);
+        sim->save_checkpoint(checkpoints[j]);
+    }
+    sim.reset();
+
+    // 4. detailed runs, in parallel
+    unsigned threads = opt.threads ? opt.threads : max(1u, thread::hardware_concurrency());
+    atomic<bool> failed{ false };
+    WorkStealingPool(threads).run(points.size(), [&](size_t j)
+        {
+            auto s = make_sim();
+            if (!s->restore_checkpoint(checkpoints[j].data(), checkpoints[j].size()))
+            {
+                failed = true;
+                return;
+            }
+            if (warmups[j] > 0)
+                s->run(opt.max_cycles, s->committed_count + warmups[j]);
+            long long c0 = s->cycle_num, i0 = s->committed_count;
+            s->run(opt.max_cycles, s->committed_count + opt.interval);
+            if (s->committed_count > i0)
+                points[j].cpi = (double)(s->cycle_num - c0) / (s->committed_count - i0);
+        });
+    if (failed)
+        return false;
+
+    // 5. report
+    double cpi = 0;
+    for (auto& sp : points)
+        cpi += sp.weight * sp.cpi;
+    cout << "\n===== SimPoint =====\n";
+    cout << "Instructions: " << prof.instructions << "  Intervals: " << prof.points.size() << " x " << opt.interval
+        << "  Phases: " << points.size() << "\n\n";
+    cout << left << setw(8) << "Phase" << setw(12) << "Interval" << setw(14) << "Start" << setw(10) << "Weight" << setw(10) << "CPI" << "\n";
+    cout << fixed;
+    for (auto& sp : points)
+        cout << setw(8) << sp.cluster << setw(12) << sp.interval << setw(14) << sp.interval * opt.interval
+            << setw(10) << setprecision(4) << sp.weight << setw(10) << setprecision(3) << sp.cpi << "\n";
+    cout << "\nDetailed instructions: " << (long long)points.size() * opt.interval + accumulate(warmups.begin(), warmups.end(), 0LL) << "\n";
+    cout << setprecision(3) << "CPI (weighted): " << cpi << "\n";
+    cout << "IPC: " << (cpi > 0 ? 1 / cpi : 0.0) << "\n";
+    cout << setprecision(0) << "Estimated cycles: " << cpi * prof.instructions << "\n";
+
+    if (!opt.out.empty())
+    {
+        // "interval weight phase", one line per simulation point
+        ofstream f(opt.out);
+        for (auto& sp : points)
+            f << sp.interval << " " << setprecision(6) << sp.weight << " " << sp.cluster << "\n";
+        if (!f)
+        {
+            cerr << "Cannot write " << opt.out << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// ---------------- Library API ----------------
+// C ABI from tomasulo.h. The public entry structs mirror RS and ROBEntry
+// field for field, so the state views hand out the simulator's own arrays.
+static_assert(sizeof(int) == sizeof(int32_t), "registers are exposed as int32_t");
+static_assert(MEM_PAGE_WORDS == TOMASULO_MEM_PAGE_WORDS && MEM_PAGES == TOMASULO_MEM_PAGES, "memory page geometry");
+static_assert(NUM_RS_FAMILIES == TOMASULO_RS_FAMILIES && (int)ROBType::HALT == TOMASULO_ROB_HALT, "enum mirrors");
+#define MIRRORS(T, C, f) static_assert(offsetof(T, f) == offsetof(C, f) && sizeof(T::f) == sizeof(C::f), #T "::" #f " layout")
+static_assert(sizeof(ROBEntry) == sizeof(tomasulo_rob_entry), "ROBEntry layout");
+MIRRORS(ROBEntry, tomasulo_rob_entry, busy);
+MIRRORS(ROBEntry, tomasulo_rob_entry, type);
+MIRRORS(ROBEntry, tomasulo_rob_entry, dest);
+MIRRORS(ROBEntry, tomasulo_rob_entry, value);
+MIRRORS(ROBEntry, tomasulo_rob_entry, ready);
+MIRRORS(ROBEntry, tomasulo_rob_entry, instr_id);
+MIRRORS(ROBEntry, tomasulo_rob_entry, pc_on_issue);
+MIRRORS(ROBEntry, tomasulo_rob_entry, br_target);
+MIRRORS(ROBEntry, tomasulo_rob_entry, commit_remaining);
+static_assert(sizeof(RS) == sizeof(tomasulo_rs), "RS layout");
+MIRRORS(RS, tomasulo_rs, busy);
+MIRRORS(RS, tomasulo_rs, opcode);
+MIRRORS(RS, tomasulo_rs, rob_dest);
+MIRRORS(RS, tomasulo_rs, Vj);
+MIRRORS(RS, tomasulo_rs, Vk);
+MIRRORS(RS, tomasulo_rs, Qj);
+MIRRORS(RS, tomasulo_rs, Qk);
+MIRRORS(RS, tomasulo_rs, A);
+MIRRORS(RS, tomasulo_rs, exec_started);
+MIRRORS(RS, tomasulo_rs, exec_finished);
+MIRRORS(RS, tomasulo_rs, exec_done);
+MIRRORS(RS, tomasulo_rs, write_remaining);
+MIRRORS(RS, tomasulo_rs, instr_id);
+#undef MIRRORS
+
+struct tomasulo_sim
+{
+    MachineConfig cfg;
+    shared_ptr<const Program> prog;
+    shared_ptr<const MemoryImage> mem;
+    int halt_pc = -1;
+    unique_ptr<Simulator> sim; // null until a program is loaded
+    string checkpoint;         // last tomasulo_checkpoint() blob
+
+    // fresh Simulator over the current program and memory
+    void rebuild()
+    {
+        sim.reset();
+        if (!prog)
+            return;
+        sim = make_unique<Simulator>(cfg, prog, mem);
+        sim->committed_log.capacity = 0; // embedders read state directly; no report
+        sim->halt_pc = halt_pc;
+        sim->init_structures();
+    }
+
+    bool finished() const { return !sim || sim->program.empty() || sim->halted || sim->all_committed(); }
+};
+
+extern "C" {
+
+tomasulo_sim* tomasulo_create(const char* config)
+{
+    try
+    {
+        auto s = make_unique<tomasulo_sim>();
+        if (config)
+        {
+            istringstream lines(config);
+            for (string line; getline(lines, line);)
+                if (!apply_config_line(s->cfg, line))
+                    return nullptr;
+        }
+        if (!validate_config(s->cfg))
+            return nullptr;
+        return s.release();
+    }
+    catch (...)
+    {
+        return nullptr;
+    }
+}
+
+void tomasulo_destroy(tomasulo_sim* s)
+{
+    delete s;
+}
+
+int tomasulo_load_program(tomasulo_sim* s, const void* data, size_t size)
+{
+    try
+    {
+        auto prog = make_shared<Program>();
+        prog->num_reg = s->cfg.num_reg;
+        if (!load_program_buffer((const char*)data, size, *prog))
+            return -1;
+        s->prog = prog;
+        s->rebuild();
+        return 0;
+    }
+    catch (...)
+    {
+        return -1;
+    }
+}
+
+int tomasulo_load_memory(tomasulo_sim* s, const void* data, size_t size)
+{
+    try
+    {
+        shared_ptr<const MemoryImage> mem;
+        if (!load_memory_buffer((const char*)data, size, mem))
+            return -1;
+        s->mem = mem;
+        s->rebuild();
+        return 0;
     }
-    RS& rs = RS_sets[rs_set_idx].second[rs_idx];
-    rs.busy = true;
-    rs.opcode = current_ins.opcode;
-    rs.instr_id = current_ins.id;
-    rs.exec_started = false;
-    rs.exec_remaining = OPCODES.at(current_ins.opcode).exec_latency;
-    rs.Qj = rs.Qk = -1;
-    rs.Vj = rs.Vk = 0;
-    rs.A = 0;
-    rs.rob_dest = rob_idx;
+    catch (...)
+    {
+        return -1;
+    }
+}
 
-    // fill ROB entry metadata
-    ROB[rob_idx].busy = true;
-    ROB[rob_idx].ready = false;
-    ROB[rob_idx].instr_id = current_ins.id;
-    ROB[rob_idx].pc_on_issue = current_ins.addr;
+void tomasulo_set_halt_pc(tomasulo_sim* s, int32_t pc)
+{
+    s->halt_pc = pc;
+    if (s->sim)
+        s->sim->halt_pc = pc; // takes effect from the next step
+}
 
-    // Decode operands based on opcode (updated for your formats)
-    auto getRegOrImm = [&](int token, int& val, int& tag)
-        {
-            tag = -1;
-            if (token >= 0 && token < NUM_REG)
-            {
-                if (token == 0)
-                {
-                    val = 0;
-                    tag = -1;
-                }
-                else if (reg_tag[token] != -1)
-                {
-                    tag = reg_tag[token];
-                    val = 0;
-                }
-                else
-                {
-                    val = regs[token];
-                    tag = -1;
-                }
-            }
-            else
-            {
-                val = token;
-                tag = -1;
-            } // immediate or out-of-range treated immediate
-        };
+void tomasulo_reset(tomasulo_sim* s)
+{
+    try
+    {
+        if (!s->sim)
+            return;
+        s->sim->memory_mem.reset();
+        s->sim->halt_pc = s->halt_pc;
+        s->sim->init_structures();
+    }
+    catch (...)
+    {
+    }
+}
 
-    string opname = OPCODES.at(current_ins.opcode).name;
-    if (opname == "LOAD")
+const void* tomasulo_checkpoint(tomasulo_sim* s, size_t* size)
+{
+    try
     {
-        // 1 rd rs1 imm  => LOAD rd, imm(rs1)
-        ROB[rob_idx].type = "REG";
-        ROB[rob_idx].dest = current_ins.rd;
-        int val, tag;
-        getRegOrImm(current_ins.rs1, val, tag);  // rs1 (base)
-        if (tag != -1)
-            rs.Qj = tag;
-        else
-            rs.Vj = val;
-        rs.A = current_ins.rs2_imm;  // imm (offset)
+        s->checkpoint.clear();
+        if (s->sim)
+            s->sim->save_checkpoint(s->checkpoint);
+        *size = s->checkpoint.size();
+        return s->sim ? s->checkpoint.data() : nullptr;
     }
-    else if (opname == "STORE")
+    catch (...)
     {
-        // 2 rs2 rs1 imm => STORE rs2, imm(rs1)
-        ROB[rob_idx].type = "STORE";
-        int val, tag;
-        getRegOrImm(current_ins.rs1, val, tag);  // rs1 (base)
-        if (tag != -1)
-            rs.Qj = tag;
-        else
-            rs.Vj = val;
-        rs.A = current_ins.rs2_imm;  // imm (offset)
-        // rs2 (data to store)
-        int val2, tag2;
-        getRegOrImm(current_ins.rd, val2, tag2);  // rs2 is in current_ins.rd
-        if (tag2 != -1)
-            rs.Qk = tag2;
-        else
-            rs.Vk = val2;
+        *size = 0;
+        return nullptr;
     }
+}
 
-    else if (opname == "BEQ")
+int tomasulo_restore(tomasulo_sim* s, const void* data, size_t size)
+{
+    try
     {
-        // 3 rs1 rs2 imm => BEQ rs1, rs2, imm
-        ROB[rob_idx].type = "BR";
-        ++branch_count;
-        int v1, t1, v2, t2;
-        getRegOrImm(current_ins.rd, v1, t1);   // rs1
-        getRegOrImm(current_ins.rs1, v2, t2);  // rs2
-        if (t1 != -1)
-            rs.Qj = t1;
-        else
-            rs.Vj = v1;
-        if (t2 != -1)
-            rs.Qk = t2;
-        else
-            rs.Vk = v2;
-        // correct PC_at_issue = current_ins.addr
-        int pc_issue = current_ins.addr;
+        return s->sim && s->sim->restore_checkpoint((const char*)data, size) ? 0 : -1;
+    }
+    catch (...)
+    {
+        return -1;
+    }
+}
 
-        // branch target = PC_at_issue + 1 + imm
-        ROB[rob_idx].br_target = pc_issue + 1 + current_ins.rs2_imm;
+uint64_t tomasulo_step(tomasulo_sim* s, uint64_t n)
+{
+    try
+    {
+        uint64_t done = 0;
+        while (done < n && s->sim && s->sim->step())
+            ++done;
+        return done;
     }
-    else if (opname == "CALL")
+    catch (...)
     {
-        // 8 0 0 imm => CALL imm
-        ROB[rob_idx].type = "CALL";
-        ROB[rob_idx].dest = 1;                 // R1 holds return address (logical)
-        ROB[rob_idx].br_target = current_ins.rs2_imm;  // imm (absolute target)
-        
-        // Save return address (PC + 1) in ROB to be written to R1 at commit
-        ROB[rob_idx].value = wrap16(current_ins.addr + 1);
-        
-        // mark R1 as pending (so subsequent reads wait)
-        reg_tag[1] = rob_idx;
+        return 0;
     }
+}
 
-    else if (opname == "RET")
+uint64_t tomasulo_run_until(tomasulo_sim* s, tomasulo_predicate pred, void* user, uint64_t max_cycles)
+{
+    try
     {
-        // 9 0 0 0 => RET
-        ROB[rob_idx].type = "RET";
-        // RET depends on R1 (return address). If R1 is pending, tag it.
-        if (reg_tag[1] != -1) {
-            rs.Qj = reg_tag[1];
-        } else {
-            rs.Vj = regs[1];
-            rs.Qj = -1;
+        uint64_t done = 0;
+        while (done < max_cycles && s->sim && s->sim->step())
+        {
+            ++done;
+            if (pred && pred(s, user))
+                break;
         }
+        return done;
     }
-    else
+    catch (...)
     {
-        // ALU ops: ADD/SUB/NAND/MUL  (4 rd rs1 rs2)
-        ROB[rob_idx].type = "REG";
-        ROB[rob_idx].dest = current_ins.rd;
-        int v1, t1, v2, t2;
-        getRegOrImm(current_ins.rs1, v1, t1);       // rs1
-        getRegOrImm(current_ins.rs2_imm, v2, t2);   // rs2
-        if (t1 != -1)
-            rs.Qj = t1;
-        else
-            rs.Vj = v1;
-        if (t2 != -1)
-            rs.Qk = t2;
-        else
-            rs.Vk = v2;
+        return 0;
     }
+}
+
+void tomasulo_get_stats(const tomasulo_sim* s, tomasulo_stats* out)
+{
+    *out = tomasulo_stats();
+    out->finished = s->finished();
+    out->halted_at = -1;
+    if (!s->sim)
+        return;
+    const Simulator& sim = *s->sim;
+    out->cycles = sim.cycle_num;
+    out->committed = sim.committed_count;
+    out->branches = sim.branch_count;
+    out->mispredictions = sim.mispredictions;
+    out->pc = sim.PC;
+    out->halted = sim.halted;
+    out->halted_at = sim.halted_at;
+}
+
+const tomasulo_rob_entry* tomasulo_rob(const tomasulo_sim* s, int32_t* size, int32_t* head, int32_t* count)
+{
+    const Simulator* sim = s->sim.get();
+    *size = sim ? (int32_t)sim->ROB.size() : 0;
+    *head = sim ? sim->rob_head : 0;
+    *count = sim ? sim->rob_count : 0;
+    return sim ? (const tomasulo_rob_entry*)sim->ROB.data() : nullptr;
+}
 
-    // if ROB writes to register, set reg_tag
-    if ((ROB[rob_idx].type == "REG" || ROB[rob_idx].type == "CALL") && ROB[rob_idx].dest >= 0 && ROB[rob_idx].dest < NUM_REG)
+const tomasulo_rs* tomasulo_rs_family(const tomasulo_sim* s, int32_t family, int32_t* size)
+{
+    *size = 0;
+    if (!s->sim || family < 0 || family >= NUM_RS_FAMILIES)
+        return nullptr;
+    const vector<RS>& set = s->sim->RS_sets[family];
+    *size = (int32_t)set.size();
+    return (const tomasulo_rs*)set.data();
+}
+
+const int32_t* tomasulo_regs(const tomasulo_sim* s, int32_t* size)
+{
+    *size = s->sim ? (int32_t)s->sim->regs.size() : 0;
+    return s->sim ? (const int32_t*)s->sim->regs.data() : nullptr;
+}
+
+const uint16_t* tomasulo_mem_page(const tomasulo_sim* s, int32_t page)
+{
+    static const uint16_t zero_page[MEM_PAGE_WORDS] = {};
+    if (page < 0 || page >= MEM_PAGES)
+        return zero_page;
+    const uint16_t* pg = nullptr;
+    if (s->sim)
+        pg = s->sim->memory_mem.page(page);
+    else if (s->mem)
+        pg = s->mem->pages[page];
+    return pg ? pg : zero_page;
+}
+
+} // extern "C"
+
+// ---------------- Benchmarks ----------------
+// Redirect scaling: a loop of ADD and an always-taken BEQ back to it, followed
+// by padding that is fetched down the not-taken path and flushed at every
+// branch commit. Host time per redirect should not grow with program size.
+void bench_redirect()
+{
+    cout << left << setw(12) << "Program" << setw(10) << "Cycles" << setw(12) << "Redirects"
+        << setw(12) << "ns/cycle" << "ns/redirect\n";
+    for (int size : { 1000, 10000, 100000, 1000000 })
     {
-        if (ROB[rob_idx].dest != 0)
-            reg_tag[ROB[rob_idx].dest] = rob_idx;
+        auto prog = make_shared<Program>();
+        prog->num_reg = cfg.num_reg;
+        vector<Instr>& program = prog->instrs;
+        program.assign(size, Instr());
+        for (int i = 0; i < size; ++i)
+        {
+            Instr& ins = program[i];
+            ins.id = ins.addr = i;
+            if (i == 0)
+                ins.opcode = 4, ins.rd = 1, ins.rs1 = 1, ins.rs2_imm = 0; // ADD R1, R1, R0
+            else if (i == 1)
+                ins.opcode = 3, ins.rd = 0, ins.rs1 = 0, ins.rs2_imm = -2; // BEQ R0, R0, -2
+            else
+                ins.opcode = 6, ins.rd = 2, ins.rs1 = 2, ins.rs2_imm = 3; // NAND R2, R2, R3
+            decode_instr(ins, prog->num_reg);
+        }
+        Simulator sim(cfg, prog, nullptr);
+
+        const int cycles = 200000;
+        auto t0 = chrono::steady_clock::now();
+        for (int c = 0; c < cycles; ++c)
+            sim.step();
+        double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - t0).count();
+        cout << setw(12) << size << setw(10) << sim.cycle_num << setw(12) << sim.mispredictions << fixed << setprecision(1)
+            << setw(12) << ns / sim.cycle_num << (sim.mispredictions ? ns / sim.mispredictions : 0.0) << "\n";
     }
+}
 
-    // set instruction metadata
-    current_ins.issue = cycle_num;
-    current_ins.rob_idx = rob_idx;
+// ---------------- Benchmark suite ----------------
+// --bench SUITE runs every benchmark in a suite file to completion `reps`
+// times and reports the median host time of the run itself, the simulated
+// KIPS (committed instructions per host second / 1000) and the guest IPC.
+// --out saves the results as a baseline; --baseline compares against one and
+// fails when a benchmark's KIPS dropped by more than `threshold` percent.
+const long long BENCH_MAX_CYCLES = 1000000000; // a benchmark that has not halted by then is broken
 
-    // advance fetch queue and PC
-    fetch_queue.pop_front();
-    
-    // CALL jumps immediately to target address
-    if (opname == "CALL") {
-        PC = current_ins.rs2_imm;  // Jump to call target
-        // Rebuild fetch queue from new PC
-        fetch_queue.clear();
-        for (size_t i = 0; i < program.size(); ++i) {
-            if (program[i].addr >= PC) fetch_queue.push_back((int)i);
+struct BenchOptions
+{
+    int reps = 5;
+    double threshold = 5.0; // percent
+    string baseline;        // compare against this file
+    string out;             // save the results here as a baseline
+    bool event_driven = false;
+};
+
+struct BenchCase
+{
+    string name;
+    string prog_file, mem_file; // mem_file empty: no memory image
+    vector<string> settings;    // key=value on top of cfg
+};
+
+struct BenchResult
+{
+    long long cycles = 0;
+    long long committed = 0;
+    double seconds = 0; // median host time
+    double kips() const { return seconds > 0 ? committed / seconds / 1000 : 0.0; }
+};
+
+// name program memory|- [key=value ...] per line; paths relative to the suite
+bool load_bench_suite(const string& fname, vector<BenchCase>& cases)
+{
+    ifstream f(fname);
+    if (!f)
+    {
+        cerr << "Cannot open benchmark suite: " << fname << "\n";
+        return false;
+    }
+    size_t slash = fname.find_last_of("/\\");
+    string dir = slash == string::npos ? string() : fname.substr(0, slash + 1);
+    auto path = [&](const string& p) { return p.empty() || p[0] == '/' || p[0] == '\\' || p.find(':') != string::npos ? p : dir + p; };
+    string line;
+    while (getline(f, line))
+    {
+        if (line.find('#') != string::npos)
+            line.erase(line.find('#'));
+        istringstream iss(line);
+        BenchCase c;
+        string mem;
+        if (!(iss >> c.name))
+            continue;
+        if (!(iss >> c.prog_file >> mem))
+        {
+            cerr << "Benchmark line needs name, program and memory (- for none): " << line << "\n";
+            return false;
         }
-    } else {
-        PC = PC + 1; // sequential next instruction address
+        c.prog_file = path(c.prog_file);
+        if (mem != "-")
+            c.mem_file = path(mem);
+        for (string kv; iss >> kv;)
+            c.settings.push_back(kv);
+        cases.push_back(c);
+    }
+    if (cases.empty())
+    {
+        cerr << "Benchmark suite lists no benchmarks: " << fname << "\n";
+        return false;
     }
+    return true;
 }
 
-// Execute stage: decrement exec_remaining for started RS entries if operands ready
-void do_execute()
+// name cycles instructions seconds kips per line, as written by save_bench_baseline
+bool load_bench_baseline(const string& fname, map<string, BenchResult>& out)
 {
-    // reset cdb flag for this cycle
-    cdb_used = 0;
-    // For each RS set and each RS, if operands ready and not started, start; if started decrement
-    for (auto& set : RS_sets)
+    ifstream f(fname);
+    if (!f)
+    {
+        cerr << "Cannot open benchmark baseline: " << fname << "\n";
+        return false;
+    }
+    string line;
+    while (getline(f, line))
     {
-        for (auto& rs : set.second)
+        if (line.find('#') != string::npos)
+            line.erase(line.find('#'));
+        istringstream iss(line);
+        string name;
+        BenchResult r;
+        if (!(iss >> name))
+            continue;
+        if (!(iss >> r.cycles >> r.committed >> r.seconds))
         {
-            if (!rs.busy)
-                continue;
-            // attempt to resolve operands from ROB if they are tagged
-            if (rs.Qj != -1 && ROB[rs.Qj].ready)
-            {
-                rs.Vj = ROB[rs.Qj].value;
-                rs.Qj = -1;
-            }
-            if (rs.Qk != -1 && ROB[rs.Qk].ready)
+            cerr << "Bad baseline line: " << line << "\n";
+            return false;
+        }
+        out[name] = r;
+    }
+    return true;
+}
+
+bool save_bench_baseline(const string& fname, const vector<BenchCase>& cases, const vector<BenchResult>& results)
+{
+    ofstream f(fname);
+    if (!f)
+    {
+        cerr << "Cannot write benchmark baseline: " << fname << "\n";
+        return false;
+    }
+    f << "# tomasulo_sim --bench baseline; host times are only comparable on the same machine and build\n";
+    f << "# name cycles instructions median_seconds kips\n";
+    for (size_t i = 0; i < cases.size(); ++i)
+        f << cases[i].name << " " << results[i].cycles << " " << results[i].committed << " " << fixed << setprecision(6)
+            << results[i].seconds << " " << setprecision(1) << results[i].kips() << "\n";
+    return (bool)f;
+}
+
+bool run_bench_suite(const string& suite_file, const BenchOptions& opt)
+{
+    vector<BenchCase> cases;
+    if (!load_bench_suite(suite_file, cases))
+        return false;
+    map<string, BenchResult> baseline;
+    if (!opt.baseline.empty() && !load_bench_baseline(opt.baseline, baseline))
+        return false;
+
+    cerr << "Running " << cases.size() << " benchmarks x " << opt.reps << " runs\n";
+    vector<BenchResult> results(cases.size());
+    for (size_t i = 0; i < cases.size(); ++i)
+    {
+        const BenchCase& bc = cases[i];
+        MachineConfig c = cfg;
+        for (auto& kv : bc.settings)
+            if (!apply_config_line(c, kv))
+                return false;
+        if (!validate_config(c))
+            return false;
+        auto prog = make_shared<Program>();
+        prog->num_reg = c.num_reg;
+        if (!load_program(bc.prog_file, *prog))
+        {
+            cerr << "Failed to load program file: " << bc.prog_file << "\n";
+            return false;
+        }
+        shared_ptr<const MemoryImage> mem;
+        if (!bc.mem_file.empty() && !load_memory(bc.mem_file, mem))
+        {
+            cerr << "Cannot open memory file: " << bc.mem_file << "\n";
+            return false;
+        }
+
+        // only the run is timed; every run must give the same guest timing
+        vector<double> seconds;
+        BenchResult& r = results[i];
+        for (int rep = 0; rep < opt.reps; ++rep)
+        {
+            Simulator sim(c, prog, mem);
+            sim.event_driven = opt.event_driven;
+            sim.committed_log.capacity = 0; // no report: keep no history
+            sim.init_structures();
+            auto t0 = chrono::steady_clock::now();
+            sim.run(BENCH_MAX_CYCLES, 0);
+            seconds.push_back(chrono::duration<double>(chrono::steady_clock::now() - t0).count());
+            if (!sim.finished())
             {
-                rs.Vk = ROB[rs.Qk].value;
-                rs.Qk = -1;
+                cerr << bc.name << ": not finished after " << sim.cycle_num << " cycles\n";
+                return false;
             }
-            Instr& ins = program[rs.instr_id];
-            if (!rs.exec_started)
+            if (rep > 0 && (sim.cycle_num != r.cycles || sim.committed_count != r.committed))
             {
-                bool ready = (rs.Qj == -1 && rs.Qk == -1);
-                // For STORE only base needed to start, handled later
-                if (ready)
-                {
-                    rs.exec_started = true;
-                    if (ins.exec_start == -1)
-                        ins.exec_start = cycle_num;
-                    // consume one cycle immediately (this cycle)
-                    rs.exec_remaining -= 1;
-                    if (rs.exec_remaining == 0)
-                    {
-                        ins.exec_end = cycle_num;
-                        string opname = OPCODES.at(ins.opcode).name;
-                        rs.write_remaining = (opname == "STORE") ? 0 : 1;
-                    }
-                }
+                cerr << bc.name << ": runs differ (" << r.cycles << " and " << sim.cycle_num << " cycles)\n";
+                return false;
             }
+            r.cycles = sim.cycle_num;
+            r.committed = sim.committed_count;
+        }
+        nth_element(seconds.begin(), seconds.begin() + seconds.size() / 2, seconds.end());
+        r.seconds = seconds[seconds.size() / 2];
+    }
+
+    cout << left << setw(16) << "Benchmark" << right << setw(12) << "Cycles" << setw(14) << "Instructions" << setw(8) << "IPC"
+        << setw(12) << "Median s" << setw(10) << "KIPS";
+    if (!opt.baseline.empty())
+        cout << setw(14) << "Base KIPS" << setw(9) << "Change";
+    cout << "\n";
+    int regressed = 0;
+    vector<string> notes;
+    for (size_t i = 0; i < cases.size(); ++i)
+    {
+        const BenchResult& r = results[i];
+        cout << left << setw(16) << cases[i].name << right << setw(12) << r.cycles << setw(14) << r.committed << fixed
+            << setprecision(3) << setw(8) << (r.cycles ? (double)r.committed / r.cycles : 0.0) << setprecision(4) << setw(12)
+            << r.seconds << setprecision(1) << setw(10) << r.kips();
+        if (!opt.baseline.empty())
+        {
+            auto it = baseline.find(cases[i].name);
+            if (it == baseline.end())
+                cout << setw(14) << "-" << setw(9) << "new";
             else
             {
-                if (rs.exec_remaining > 0)
+                const BenchResult& b = it->second;
+                double change = b.kips() > 0 ? 100.0 * (r.kips() / b.kips() - 1) : 0.0;
+                cout << setw(14) << b.kips() << setw(8) << showpos << change << noshowpos << "%";
+                if (change < -opt.threshold)
                 {
-                    rs.exec_remaining -= 1;
-                    if (rs.exec_remaining == 0)
-                    {
-                        ins.exec_end = cycle_num;
-                        string opname = OPCODES.at(ins.opcode).name;
-                        rs.write_remaining = (opname == "STORE") ? 0 : 1;
-                    }
+                    cout << "  REGRESSION";
+                    ++regressed;
                 }
+                // a different guest timing means the model changed, not just its speed
+                if (b.cycles != r.cycles || b.committed != r.committed)
+                    notes.push_back(cases[i].name + ": guest timing changed from " + to_string(b.cycles) + " cycles / "
+                        + to_string(b.committed) + " instructions");
             }
         }
+        cout << "\n";
     }
+    for (auto& n : notes)
+        cout << "Note: " << n << "\n";
 
-    // Special handling for STORE: only wait for base (Qj) to start execution, then respect latency
-    for (auto& set : RS_sets)
+    if (!opt.out.empty() && !save_bench_baseline(opt.out, cases, results))
+        return false;
+    if (regressed > 0)
     {
-        for (auto& rs : set.second)
+        cout << regressed << " of " << cases.size() << " benchmarks lost more than " << opt.threshold << "% throughput\n";
+        return false;
+    }
+    return true;
+}
+
+// ---------------- Workload generator ----------------
+// --generate PROGRAM MEMORY [key=value ...] writes a large random program and
+// its memory file, for scaling and ROB/RS pressure tests. Every choice comes
+// from splitmix64 over the seed (no library distributions), so the same
+// settings give the same files on every machine. A .tpi or .tmi name writes
+// the binary image instead of text.
+//
+// Layout: register init; a BEQ over the CALL chain f1..f(call.depth), each
+// saving R1 in a slot at the top of memory before it calls the next; regions,
+// each a loop nest of loop.depth levels around a body of `block` instructions
+// drawn from the mix; HALT. CALL links a 16-bit return address, so the chain
+// sits in the low 64K and only regions there call f1. R0 is zero, R1 the link, R2 the data pointer, then one
+// counter per loop level; the rest are scratch. Loads and stores walk a
+// footprint-word region at `stride` words from R2. A BEQ from the mix loads a
+// flag that is 0 with probability `taken`, and if so skips 1-3 instructions.
+struct GenOptions
+{
+    uint64_t seed = 1;
+    long long size = 10000; // static instructions, rounded to whole regions
+    int num_reg = 8;
+    int mix[NUM_OPCODES] = { 0, 2, 1, 1, 4, 2, 1, 1, 0, 0, 0 }; // weights of LOAD..MUL in a body
+    int chain = 2;          // dependent instructions in a row
+    double taken = 0.5;     // taken ratio of the mix BEQs
+    int loop_depth = 1;
+    int loop_iters = 4;
+    int block = 32;         // mix instructions per loop body
+    int call_depth = 2;     // 0: no CALLs
+    int call_every = 4;     // one region in call_every calls f1
+    int footprint = 4096;   // data words, rounded up to a power of two
+    int stride = 1;
+};
+
+const long long GEN_MAX_SIZE = 100000000;
+const int GEN_MAX_FOOTPRINT = 8192; // data and flag regions (2 x 2 x footprint) fit below the call slots
+
+bool apply_gen_setting(GenOptions& g, const string& key, const string& value)
+{
+    auto bad = [&]
         {
-            if (!rs.busy || rs.exec_started) continue;
-            if (rs.opcode == 2) // STORE
+            cerr << "Bad value for " << key << ": '" << value << "'\n";
+            return false;
+        };
+    if (key == "taken")
+    {
+        char* end = nullptr;
+        g.taken = strtod(value.c_str(), &end);
+        return *end == '\0' && g.taken >= 0 && g.taken <= 1 ? true : bad();
+    }
+    if (key == "seed")
+    {
+        auto r = from_chars(value.data(), value.data() + value.size(), g.seed);
+        return r.ec == errc() && r.ptr == value.data() + value.size() ? true : bad();
+    }
+    long long v = 0;
+    auto r = from_chars(value.data(), value.data() + value.size(), v);
+    if (r.ec != errc() || r.ptr != value.data() + value.size() || v < 0 || v > GEN_MAX_SIZE)
+        return bad();
+    if (key.compare(0, 4, "mix.") == 0)
+    {
+        string name = key.substr(4);
+        for (char& ch : name)
+            ch = (char)toupper((unsigned char)ch);
+        for (int op = 1; op <= (int)Op::MUL; ++op)
+            if (name == OPCODES[op].name)
             {
-                bool ready = (rs.Qj == -1);  // Only base needs to be ready to start
-                if (ready)
-                {
-                    rs.exec_started = true;
-                    Instr& ins = program[rs.instr_id];
-                    if (ins.exec_start == -1)
-                        ins.exec_start = cycle_num;
-                    // exec_remaining already set at issue to STORE latency
-                }
+                g.mix[op] = (int)v;
+                return true;
             }
-        }
+        cerr << "Unknown opcode in generator key (LOAD, STORE, BEQ, ADD, SUB, NAND or MUL): " << key << "\n";
+        return false;
+    }
+    if (key == "size")
+        g.size = v;
+    else if (key == "num_reg")
+        g.num_reg = (int)v;
+    else if (key == "chain")
+        g.chain = (int)v;
+    else if (key == "loop.depth")
+        g.loop_depth = (int)v;
+    else if (key == "loop.iters")
+        g.loop_iters = (int)v;
+    else if (key == "block")
+        g.block = (int)v;
+    else if (key == "call.depth")
+        g.call_depth = (int)v;
+    else if (key == "call.every")
+        g.call_every = (int)v;
+    else if (key == "mem.footprint")
+        g.footprint = (int)v;
+    else if (key == "mem.stride")
+        g.stride = (int)v;
+    else
+    {
+        cerr << "Unknown generator key: " << key << "\n";
+        return false;
     }
+    return true;
 }
 
-// Write-back stage: pick at most one finished RS to write to ROB/CDB
-void do_write()
+bool validate_gen_options(const GenOptions& g)
 {
-    // reset cdb flag for this cycle
-    cdb_used = 0;
+    bool ok = true;
+    auto check = [&](bool cond, const string& what)
+        {
+            if (!cond)
+                cerr << "Invalid generator setting: " << what << "\n";
+            ok = ok && cond;
+        };
+    int scratch = g.num_reg - 3 - g.loop_depth;
+    check(g.size >= 1, "size must be at least 1");
+    check(g.num_reg >= 5 && g.num_reg <= 32, "num_reg must be between 5 and 32");
+    check(scratch >= 2, "num_reg must leave 2 scratch registers after R0-R2 and the loop counters");
+    check(accumulate(g.mix, g.mix + NUM_OPCODES, 0LL) > 0, "mix weights must not all be 0");
+    check(g.chain >= 1, "chain must be at least 1");
+    check(g.loop_iters >= 1 && g.loop_iters <= 0xFFFF, "loop.iters must be between 1 and 65535");
+    check(g.block >= 1, "block must be at least 1");
+    check(g.call_depth <= 1024, "call.depth must be at most 1024");
+    check(g.call_every >= 1, "call.every must be at least 1");
+    // init, the skip BEQ and the chain (at most block + 8 per function) all below 0xFFFF
+    check((long long)g.call_depth * (g.block + 8) + g.num_reg + 1 < 0xFFFF, "the CALL chain (call.depth x (block + 8)) must fit in 64K instructions");
+    check(g.footprint >= 1 && g.footprint <= GEN_MAX_FOOTPRINT, "mem.footprint must be between 1 and " + to_string(GEN_MAX_FOOTPRINT));
+    return ok;
+}
+
+class WorkloadGenerator
+{
+public:
+    explicit WorkloadGenerator(const GenOptions& o) : opt(o), state(o.seed)
+    {
+        // at least 64 so the mask is an immediate, not a register token
+        while (footprint < opt.footprint || footprint < 64)
+            footprint *= 2;
+        flag_base = 2 * footprint;
+        for (int r = 3 + opt.loop_depth; r < opt.num_reg; ++r)
+            scratch.push_back(r);
+        written.assign(opt.num_reg, -1);
+        mix_total = accumulate(opt.mix, opt.mix + NUM_OPCODES, 0);
+    }
 
-    // find the oldest RS ready to write
-    int chosen_set = -1, chosen_idx = -1;
-    int chosen_pc = INT_MAX;
-    for (size_t s = 0; s < RS_sets.size(); ++s)
+    void generate(Program& prog, MemoryImage& mem)
     {
-        for (size_t i = 0; i < RS_sets[s].second.size(); ++i)
+        out = &prog.instrs;
+        out->clear();
+        prog.start_pc = 0;
+        for (int r : scratch)
+            set_reg(r, 1 + below(0xFFFF));
+        size_t skip = out->size();
+        if (opt.call_depth > 0)
+            emit(Op::BEQ, 0, 0, 0); // over the chain, patched below
+
+        vector<int> func_start;
+        for (int f = 0; f < opt.call_depth; ++f)
         {
-            RS& rs = RS_sets[s].second[i];
-            if (!rs.busy || !rs.exec_started || rs.exec_remaining > 0)
-                continue;
-            Instr& ins = program[rs.instr_id];
-            if (ins.write != -1)
-                continue; // already written
-            if (ins.addr < chosen_pc)
+            func_start.push_back((int)out->size());
+            bool calls_next = f + 1 < opt.call_depth;
+            if (calls_next)
+                emit(Op::STORE, 1, 0, MEM_SIZE - 1 - f); // save R1
+            emit_body();
+            if (calls_next)
+            {
+                calls.push_back({ out->size(), f + 1 });
+                emit(Op::CALL, 0, 0, 0);
+                emit(Op::LOAD, 1, 0, MEM_SIZE - 1 - f);
+            }
+            emit(Op::RET, 0, 0, 0);
+        }
+        if (opt.call_depth > 0)
+            (*out)[skip].rs2_imm = (int)(out->size() - skip - 1);
+
+        for (long long region = 0; region == 0 || (long long)out->size() < opt.size; ++region)
+            emit_region(opt.call_depth > 0 && region % opt.call_every == 0);
+        emit(Op::HALT, 0, 0, 0);
+        for (auto& c : calls)
+            (*out)[c.first].rs2_imm = prog.start_pc + func_start[c.second];
+
+        prog.text_lines.clear();
+        prog.text_lines.reserve(out->size());
+        for (Instr& ins : *out)
+        {
+            ins.addr = prog.start_pc + ins.id;
+            decode_instr(ins, opt.num_reg);
+            prog.text_lines.push_back(to_string(ins.opcode) + " " + to_string(ins.rd) + " " + to_string(ins.rs1) + " " + to_string(ins.rs2_imm));
+        }
+        for (size_t i = 0; i < out->size(); ++i)
+            (*out)[i].text = prog.text_lines[i];
+
+        // data words are nonzero; flags are 0 (taken) with probability `taken`
+        for (int a = 0; a < 2 * footprint; ++a)
+            mem.own_page(a >> MEM_PAGE_BITS)[a & MEM_PAGE_MASK] = (uint16_t)(1 + below(0xFFFF));
+        for (int a = flag_base; a < flag_base + 2 * footprint; ++a)
+            mem.own_page(a >> MEM_PAGE_BITS)[a & MEM_PAGE_MASK] = chance(opt.taken) ? 0 : 1;
+        mem.finish_loading();
+    }
+
+    int data_footprint() const { return footprint; }
+
+private:
+    const GenOptions& opt;
+    uint64_t state;
+    int footprint = 1, flag_base = 0;
+    vector<int> scratch;
+    vector<long long> written; // per register: index of the instruction that last wrote it
+    int mix_total = 0;
+    int last = -1, chain_pos = 0; // end of the current dependency chain
+    long long accesses = 0;       // memory accesses since R2 last moved
+    vector<Instr>* out = nullptr;
+    vector<pair<size_t, int>> calls; // CALL sites in the chain and the function they call
+
+    uint64_t next()
+    {
+        uint64_t r = splitmix64(state);
+        state += 0x9E3779B97F4A7C15ULL;
+        return r;
+    }
+    int below(int n) { return (int)(next() % (uint64_t)n); }
+    bool chance(double p) { return (next() >> 11) * (1.0 / 9007199254740992.0) < p; }
+
+    void emit(Op op, int a, int b, int c)
+    {
+        Instr ins;
+        ins.id = (int)out->size();
+        ins.opcode = (int)op;
+        ins.rd = a;
+        ins.rs1 = b;
+        ins.rs2_imm = c;
+        out->push_back(ins);
+    }
+
+    // rd = rs + k; a k that reads as a register token is added with SUB -k
+    void add_imm(int rd, int rs, int k)
+    {
+        if (k < 0 || k >= opt.num_reg)
+            emit(Op::ADD, rd, rs, k);
+        else if (k > 0)
+            emit(Op::SUB, rd, rs, -k);
+        else if (rd != rs)
+            emit(Op::ADD, rd, rs, 0);
+    }
+    void set_reg(int rd, int v) { add_imm(rd, 0, v); }
+
+    // the scratch register written longest ago: its value is most likely ready
+    int oldest() const
+    {
+        int best = scratch[0];
+        for (int r : scratch)
+            if (written[r] < written[best])
+                best = r;
+        return best;
+    }
+    int dest()
+    {
+        int r = oldest();
+        written[r] = (long long)out->size();
+        return r;
+    }
+    int source() const { return chain_pos > 0 ? last : oldest(); }
+    void produced(int r)
+    {
+        last = r;
+        chain_pos = (chain_pos + 1) % opt.chain;
+    }
+    int data_offset() { return (int)((accesses++ * opt.stride) & (footprint - 1)); }
+
+    void emit_body()
+    {
+        for (int n = 0; n < opt.block;)
+        {
+            long long pick = below(mix_total);
+            int op = 1;
+            while (pick >= opt.mix[op])
+                pick -= opt.mix[op++];
+            switch ((Op)op)
+            {
+            case Op::LOAD:
+            {
+                int d = dest();
+                emit(Op::LOAD, d, 2, data_offset());
+                chain_pos = 0; // a load starts a new chain
+                produced(d);
+                ++n;
+                break;
+            }
+            case Op::STORE:
+                emit(Op::STORE, source(), 2, data_offset());
+                chain_pos = 0;
+                ++n;
+                break;
+            case Op::BEQ:
             {
-                chosen_pc = ins.addr;
-                chosen_set = (int)s;
-                chosen_idx = (int)i;
+                int t = dest();
+                emit(Op::LOAD, t, 2, flag_base + data_offset());
+                n += 2;
+                emit(Op::BEQ, t, 0, min(1 + below(3), max(0, opt.block - n)));
+                break;
+            }
+            default:
+            {
+                int j = source();
+                int k = chance(0.25) ? opt.num_reg + below(100) : oldest();
+                int d = dest();
+                emit((Op)op, d, j, k);
+                produced(d);
+                ++n;
+                break;
+            }
             }
         }
-    }
-    if (chosen_set == -1)
-        return;
-    if (cdb_used)
-        return; // only one write per cycle
-
-    RS& rs = RS_sets[chosen_set].second[chosen_idx];
-    Instr& ins = program[rs.instr_id];
-    string opname = OPCODES.at(ins.opcode).name;
-
-    // countdown write latency, but RET has no extra delay
-    if (opname != "RET") {
-        if (rs.write_remaining > 0)
+        // move R2 past this body's accesses, wrapped to the footprint
+        int delta = (int)((accesses * opt.stride) & (footprint - 1));
+        accesses = 0;
+        if (delta != 0)
         {
-            rs.write_remaining--;
-            return;
+            int t = dest();
+            add_imm(2, 2, delta);
+            emit(Op::NAND, t, 2, footprint - 1);
+            emit(Op::NAND, 2, t, t);
         }
     }
 
-    ROB[rs.rob_dest].commit_remaining = OPCODES.at(ins.opcode).commit_latency;
-
-    // write to ROB
-    if (opname == "LOAD")
-    {
-        int addr = wrap16(rs.Vj + rs.A);
-        int val = (addr >= 0 && addr < MEM_SIZE) ? memory_mem[addr] : 0;
-        ROB[rs.rob_dest].value = val;
-        ROB[rs.rob_dest].ready = true;
-        ROB[rs.rob_dest].dest = ins.rd;
-    }
-    else if (opname == "STORE")
+    void emit_region(bool call)
     {
-        if (rs.Qk == -1)  // Wait for data (rs2) to be ready
+        vector<int> top(opt.loop_depth);
+        for (int l = 0; l < opt.loop_depth; ++l)
         {
-            int addr = wrap16(rs.Vj + rs.A);
-            ROB[rs.rob_dest].dest = addr;
-            ROB[rs.rob_dest].value = wrap16(rs.Vk);
-            ROB[rs.rob_dest].ready = true;
+            set_reg(3 + l, opt.loop_iters);
+            top[l] = (int)out->size();
         }
-        else
+        emit_body();
+        if (call && out->size() < 0xFFFF) // start_pc is 0: the return address fits in 16 bits
         {
-            return;  // Don't write yet
+            calls.push_back({ out->size(), 0 });
+            emit(Op::CALL, 0, 0, 0);
+        }
+        for (int l = opt.loop_depth - 1; l >= 0; --l)
+        {
+            add_imm(3 + l, 3 + l, -1);
+            emit(Op::BEQ, 3 + l, 0, 1);
+            emit(Op::BEQ, 0, 0, top[l] - ((int)out->size() + 1));
         }
     }
-    else if (opname == "BEQ")
-    {
-        ROB[rs.rob_dest].value = (rs.Vj == rs.Vk) ? 1 : 0;
-        ROB[rs.rob_dest].ready = true;
-    }
-    else if (opname == "CALL")
+};
+
+bool has_suffix(const string& s, const char* suffix)
+{
+    size_t n = strlen(suffix);
+    return s.size() >= n && equal(s.end() - n, s.end(), suffix, [](char x, char y) { return tolower((unsigned char)x) == y; });
+}
+
+bool write_generated_program(const Program& prog, const string& fname, const vector<string>& settings)
+{
+    if (has_suffix(fname, ".tpi"))
+        return write_program_image(prog, fname, true);
+    ofstream f(fname);
+    if (!f)
     {
-        // Return address already stored in ROB at issue; just mark ready
-        ROB[rs.rob_dest].ready = true;
+        cerr << "Cannot write program file: " << fname << "\n";
+        return false;
     }
-    else if (opname == "RET")
+    f << "// generated by tomasulo_sim --generate";
+    for (auto& s : settings)
+        f << " " << s;
+    f << "\n" << prog.start_pc << "\n";
+    for (auto& ins : prog.instrs)
+        f << ins.text << "\n";
+    return (bool)f;
+}
+
+bool write_generated_memory(const shared_ptr<const MemoryImage>& mem, const string& fname)
+{
+    if (has_suffix(fname, ".tmi"))
+        return write_memory_image(mem, fname);
+    ofstream f(fname);
+    if (!f)
     {
-        // Store the return address (value of R1) in ROB
-        ROB[rs.rob_dest].value = wrap16(rs.Vj);
-        ROB[rs.rob_dest].br_target = rs.Vj;  // Target address to jump to
-        ROB[rs.rob_dest].ready = true;
+        cerr << "Cannot write memory file: " << fname << "\n";
+        return false;
     }
-    else
-    {
-        // ALU ops: ADD, SUB, NAND, MUL
-        int result = 0;
-        if (opname == "ADD")
-            result = wrap16(rs.Vj + rs.Vk);
-        else if (opname == "SUB")
-            result = wrap16(rs.Vj - rs.Vk);
-        else if (opname == "NAND")
-            result = wrap16(~(rs.Vj & rs.Vk));
-        else if (opname == "MUL")
-            result = wrap16(rs.Vj * rs.Vk);
+    for (int page : mem->present)
+        for (int i = 0; i < MEM_PAGE_WORDS; ++i)
+            if (mem->pages[page][i] != 0)
+                f << (page << MEM_PAGE_BITS) + i << " " << mem->pages[page][i] << "\n";
+    return (bool)f;
+}
 
-        ROB[rs.rob_dest].value = result;
-        ROB[rs.rob_dest].dest = ins.rd;
-        ROB[rs.rob_dest].ready = true;
+bool generate_workload(const string& prog_file, const string& mem_file, const vector<string>& settings)
+{
+    GenOptions g;
+    for (auto& kv : settings)
+    {
+        size_t eq = kv.find('=');
+        if (eq == string::npos)
+        {
+            cerr << "Generator setting needs key=value: " << kv << "\n";
+            return false;
+        }
+        if (!apply_gen_setting(g, kv.substr(0, eq), kv.substr(eq + 1)))
+            return false;
     }
+    if (!validate_gen_options(g))
+        return false;
+    Program prog;
+    prog.num_reg = g.num_reg;
+    auto mem = make_shared<MemoryImage>();
+    WorkloadGenerator gen(g);
+    gen.generate(prog, *mem);
+    if (!write_generated_program(prog, prog_file, settings) || !write_generated_memory(mem, mem_file))
+        return false;
+    cout << "Wrote " << prog.instrs.size() << " instructions to " << prog_file << " and a " << gen.data_footprint()
+        << "-word data region to " << mem_file << "\n";
+    return true;
+}
 
-    ins.write = cycle_num;
-    cdb_used = 1;
+// ---------------- Batch runner ----------------
+// --batch MANIFEST runs one job per manifest line on --threads workers and
+// streams one JSON line per job, in manifest order, to --out (default
+// stdout). Workers read the manifest as they go, and a finished job waits
+// in a ring of BATCH_WINDOW results per worker until every job before it
+// is written. Memory therefore stays bounded however long the manifest is.
+//
+// Manifest line ('#' starts a comment; paths are relative to the manifest):
+//   program memory|- [config=FILE] [key=value ...] [R<n>=V ...] [M[addr]=V ...]
+// key=value settings and config files apply on top of the command-line
+// configuration, in the order given. R and M entries are the expected final
+// registers and memory words.
+const int BATCH_WINDOW = 64; // results held per worker
 
-    // clear RS
-    rs.clear();
-}
+struct BatchOptions
+{
+    long long max_cycles = DEFAULT_MAX_CYCLES;
+    long long max_commits = DEFAULT_MAX_COMMITS;
+    bool event_driven = false;
+    int halt_pc = -1;
+    unsigned threads = 0; // 0 = one per hardware thread
+    string out;           // empty: stdout
+};
 
+struct BatchJob
+{
+    long long index = 0;
+    int line = 0;
+    string dir; // of the manifest
+    string text;
+};
 
-// do commit stage: commit instructions in-order from ROB head
-void do_commit() {
-    if (rob_count == 0)
-        return;
+// run one manifest line and return its JSON record; sets status to
+// "pass", "fail" or "error"
+string run_batch_job(const BatchJob& job, const BatchOptions& opt, string& status)
+{
+    auto path = [&](const string& p) { return p.empty() || p[0] == '/' || p[0] == '\\' || p.find(':') != string::npos ? p : job.dir + p; };
+    istringstream iss(job.text);
+    string prog_file, mem_file;
+    iss >> prog_file >> mem_file;
+    ostringstream rec;
+    auto begin_record = [&]
+        {
+            rec.str("");
+            rec << "{\"index\": " << job.index << ", \"line\": " << job.line << ", \"program\": " << json_quoted(prog_file)
+                << ", \"memory\": " << json_quoted(mem_file);
+        };
+    begin_record();
+    auto error = [&](const string& what)
+        {
+            status = "error";
+            rec << ", \"status\": \"error\", \"error\": " << json_quoted(what) << "}";
+            return rec.str();
+        };
+    try
+    {
+        if (mem_file.empty())
+            return error("line needs a program and a memory file (- for none)");
 
-    ROBEntry& e = ROB[rob_head];
+        MachineConfig c = cfg;
+        vector<pair<int, int>> want_regs, want_mem;
+        for (string kv; iss >> kv;)
+        {
+            size_t eq = kv.find('=');
+            int index = 0, value = 0;
+            char tail = 0;
+            if (eq != string::npos && kv[0] == 'R' && sscanf(kv.c_str(), "R%d=%d%c", &index, &value, &tail) == 2)
+                want_regs.push_back({ index, wrap16(value) });
+            else if (eq != string::npos && kv[0] == 'M' && sscanf(kv.c_str(), "M[%d]=%d%c", &index, &value, &tail) == 2)
+                want_mem.push_back({ index, wrap16(value) });
+            else if (kv.compare(0, 7, "config=") == 0)
+            {
+                if (!load_config_file(c, path(kv.substr(7))))
+                    return error("cannot load " + kv);
+            }
+            else if (!apply_config_line(c, kv))
+                return error("bad setting " + kv);
+        }
+        if (!validate_config(c))
+            return error("invalid machine configuration");
+        for (auto& [r, v] : want_regs)
+            if (r < 0 || r >= c.num_reg)
+                return error("no register R" + to_string(r));
+        for (auto& [a, v] : want_mem)
+            if (a < 0 || a >= MEM_SIZE)
+                return error("no memory address " + to_string(a));
 
-    // Can only commit a busy & ready instruction
-    if (!e.busy || !e.ready)
-        return;
+        auto prog = make_shared<Program>();
+        prog->num_reg = c.num_reg;
+        if (!load_program(path(prog_file), *prog))
+            return error("cannot load program");
+        shared_ptr<const MemoryImage> mem;
+        if (mem_file != "-" && !load_memory(path(mem_file), mem))
+            return error("cannot load memory");
 
-    if (e.commit_remaining > 0) {
-        e.commit_remaining--;
-        return;  // Wait for commit latency
-    }
+        Simulator sim(c, prog, mem);
+        sim.event_driven = opt.event_driven;
+        sim.halt_pc = opt.halt_pc;
+        sim.committed_log.capacity = 0; // no report: keep no history
+        sim.init_structures();
+        sim.run(opt.max_cycles, opt.max_commits);
 
-    // Mark instruction as committed
-    int iid = e.instr_id;
-    if (iid >= 0 && iid < (int)program.size()) {
-        program[iid].commit = cycle_num;
+        vector<string> failures;
+        for (auto& [r, v] : want_regs)
+            if (sim.regs[r] != v)
+                failures.push_back("R" + to_string(r) + " = " + to_string(sim.regs[r]) + ", expected " + to_string(v));
+        for (auto& [a, v] : want_mem)
+            if (sim.memory_mem.read(a) != v)
+                failures.push_back("M[" + to_string(a) + "] = " + to_string(sim.memory_mem.read(a)) + ", expected " + to_string(v));
+        status = failures.empty() ? "pass" : "fail";
+        rec << ", \"status\": \"" << status << "\", \"cycles\": " << sim.cycle_num << ", \"committed\": " << sim.committed_count
+            << ", \"ipc\": " << fixed << setprecision(4) << (sim.cycle_num ? (double)sim.committed_count / sim.cycle_num : 0.0)
+            << ", \"halted\": " << (sim.halted ? "true" : "false") << ", \"finished\": " << (sim.finished() ? "true" : "false")
+            << ", \"regs\": [";
+        for (size_t r = 0; r < sim.regs.size(); ++r)
+            rec << (r ? ", " : "") << sim.regs[r];
+        rec << "], \"failures\": [";
+        for (size_t i = 0; i < failures.size(); ++i)
+            rec << (i ? ", " : "") << json_quoted(failures[i]);
+        rec << "]}";
+        return rec.str();
     }
-
-    // Log this committed instance so repeated executions are reported separately
-    if (iid >= 0 && iid < (int)program.size()) {
-        Instr snapshot = program[iid];
-        snapshot.id = exec_sequence++;
-        committed_log.push_back(snapshot);
+    catch (const exception& e)
+    {
+        // a job that throws still gets its own record; the batch carries on
+        begin_record();
+        return error(e.what());
     }
+}
 
-    if (e.type == "REG") {
-        int rd = e.dest;
-        if (rd > 0 && rd < NUM_REG) {  // R0 is read-only
-            regs[rd] = wrap16(e.value);
-            if (reg_tag[rd] == rob_head)
-                reg_tag[rd] = -1;
-        }
+bool run_batch(const string& manifest, const BatchOptions& opt)
+{
+    ifstream in(manifest);
+    if (!in)
+    {
+        cerr << "Cannot open batch manifest: " << manifest << "\n";
+        return false;
     }
-    else if (e.type == "STORE") {
-        int addr = e.dest;
-        if (addr >= 0 && addr < MEM_SIZE) {
-            memory_mem[addr] = wrap16(e.value);
+    ofstream file;
+    if (!opt.out.empty())
+    {
+        file.open(opt.out);
+        if (!file)
+        {
+            cerr << "Cannot write batch results: " << opt.out << "\n";
+            return false;
         }
     }
-    else if (e.type == "BR") {
-        bool taken = (e.value != 0);
-        int target = e.br_target;
+    ostream& out = opt.out.empty() ? cout : file;
+    size_t slash = manifest.find_last_of("/\\");
+    string dir = slash == string::npos ? string() : manifest.substr(0, slash + 1);
 
-        if (taken) {
-            mispredictions++;
-            PC = target;
-            
-            // Rebuild fetch queue from new PC
-            fetch_queue.clear();
-            for (size_t i = 0; i < program.size(); ++i) {
-                if (program[i].addr >= PC) fetch_queue.push_back((int)i);
-            }
-            
-            // Clear ALL younger instructions after this branch in ROB order
-            int flush_rob_idx = (rob_head + 1) % ROB_SIZE;
-            while (flush_rob_idx != rob_tail) {
-                if (ROB[flush_rob_idx].busy) {
-                    int pid = ROB[flush_rob_idx].instr_id;
-                    if (pid >= 0 && pid < (int)program.size()) {
-                        program[pid].issue = -1;
-                        program[pid].exec_start = -1;
-                        program[pid].exec_end = -1;
-                        program[pid].write = -1;
-                        program[pid].commit = -1;
-                        program[pid].rob_idx = -1;
-                    }
-                    
-                    if (ROB[flush_rob_idx].type == "REG" && ROB[flush_rob_idx].dest >= 0 && ROB[flush_rob_idx].dest < NUM_REG) {
-                        if (reg_tag[ROB[flush_rob_idx].dest] == flush_rob_idx) 
-                            reg_tag[ROB[flush_rob_idx].dest] = -1;
-                    }
-                    if (ROB[flush_rob_idx].type == "CALL" && reg_tag[1] == flush_rob_idx) {
-                        reg_tag[1] = -1;
+    unsigned threads = opt.threads ? opt.threads : max(1u, thread::hardware_concurrency());
+    const long long window = (long long)threads * BATCH_WINDOW;
+    struct Slot
+    {
+        bool ready = false;
+        string record, status;
+    };
+    vector<Slot> ring(window);
+    mutex m;
+    condition_variable space, ready;
+    long long issued = 0, written = 0;
+    int line_no = 0;
+    unsigned active = threads;
+
+    // a worker takes the next manifest line once its result has room in the ring
+    auto worker = [&]
+        {
+            for (;;)
+            {
+                BatchJob job;
+                {
+                    unique_lock<mutex> lock(m);
+                    space.wait(lock, [&] { return issued < written + window; });
+                    string line;
+                    bool got = false;
+                    while (!got && getline(in, line))
+                    {
+                        ++line_no;
+                        if (line.find('#') != string::npos)
+                            line.erase(line.find('#'));
+                        got = line.find_first_not_of(" \t\r") != string::npos;
                     }
-                    
-                    ROB[flush_rob_idx].clear();
-                    rob_count--;
-                }
-                flush_rob_idx = (flush_rob_idx + 1) % ROB_SIZE;
-            }
-            rob_tail = (rob_head + 1) % ROB_SIZE;
-            
-            // Clear RS entries for flushed instructions
-            for (auto& p : RS_sets) {
-                for (auto& rs : p.second) {
-                    if (rs.busy && rs.instr_id >= 0 && rs.instr_id < (int)program.size()) {
-                        if (program[rs.instr_id].issue == -1) {
-                            rs.clear();
-                        }
+                    if (!got)
+                    {
+                        --active;
+                        ready.notify_all();
+                        return;
                     }
+                    job.index = issued++;
+                    job.line = line_no;
+                    job.dir = dir;
+                    job.text = line;
                 }
-            }
-        }
-        // if not taken, PC already incremented at issue
-    }
-    else if (e.type == "CALL") {
-        // Save return address to R1 (value already computed at issue)
-        regs[1] = wrap16(e.value);
-        if (reg_tag[1] == rob_head) reg_tag[1] = -1;
-        // PC was already updated at issue, no jump needed here
-        // No flush - CALL is a direct jump, not a misprediction
-    }
-    else if (e.type == "RET") {
-        // Jump to return address (stored in br_target during write)
-        PC = e.br_target;
-        
-        // Rebuild fetch queue from new PC
-        fetch_queue.clear();
-        for (size_t i = 0; i < program.size(); ++i) {
-            if (program[i].addr >= PC) fetch_queue.push_back((int)i);
-        }
-        
-        // Clear ALL younger speculative instructions (everything after this RET in ROB)
-        // This is based on ROB position, not PC address
-        int flush_rob_idx = (rob_head + 1) % ROB_SIZE;  // Everything after head (which is the RET being committed)
-        while (flush_rob_idx != rob_tail) {
-            if (ROB[flush_rob_idx].busy) {
-                int pid = ROB[flush_rob_idx].instr_id;
-                if (pid >= 0 && pid < (int)program.size()) {
-                    // Reset instruction timing
-                    program[pid].issue = -1;
-                    program[pid].exec_start = -1;
-                    program[pid].exec_end = -1;
-                    program[pid].write = -1;
-                    program[pid].commit = -1;
-                    program[pid].rob_idx = -1;
-                }
-                
-                // Clear register tags
-                if (ROB[flush_rob_idx].type == "REG" && ROB[flush_rob_idx].dest >= 0 && ROB[flush_rob_idx].dest < NUM_REG) {
-                    if (reg_tag[ROB[flush_rob_idx].dest] == flush_rob_idx) 
-                        reg_tag[ROB[flush_rob_idx].dest] = -1;
-                }
-                if (ROB[flush_rob_idx].type == "CALL" && reg_tag[1] == flush_rob_idx) {
-                    reg_tag[1] = -1;
-                }
-                
-                ROB[flush_rob_idx].clear();
-                rob_count--;
-            }
-            flush_rob_idx = (flush_rob_idx + 1) % ROB_SIZE;
-        }
-        rob_tail = (rob_head + 1) % ROB_SIZE;  // Reset tail to right after head
-        
-        // Clear all RS entries for flushed instructions
-        for (auto& p : RS_sets) {
-            for (auto& rs : p.second) {
-                if (rs.busy && rs.instr_id >= 0 && rs.instr_id < (int)program.size()) {
-                    if (program[rs.instr_id].issue == -1) {  // Was flushed
-                        rs.clear();
-                    }
+                string status;
+                string record = run_batch_job(job, opt, status);
+                {
+                    lock_guard<mutex> lock(m);
+                    Slot& s = ring[job.index % window];
+                    s.record = move(record);
+                    s.status = move(status);
+                    s.ready = true;
                 }
+                ready.notify_all();
             }
-        }
-    }
-
-    // Free this ROB entry and advance head
-    e.clear();
-    rob_head = (rob_head + 1) % ROB_SIZE;
-    rob_count--;
+        };
+    vector<thread> workers;
+    for (unsigned t = 0; t < threads; ++t)
+        workers.emplace_back(worker);
 
-    // Optionally try to commit next instruction in the same cycle
-    if (rob_count > 0) {
-        do_commit();
+    // write the results in manifest order as they complete
+    long long passed = 0, failed = 0, errors = 0;
+    for (;;)
+    {
+        unique_lock<mutex> lock(m);
+        ready.wait(lock, [&] { return ring[written % window].ready || (active == 0 && written == issued); });
+        Slot& s = ring[written % window];
+        if (!s.ready)
+            break;
+        string record = move(s.record);
+        string status = move(s.status);
+        s = Slot();
+        ++written;
+        lock.unlock();
+        space.notify_all();
+        out << record << "\n";
+        (status == "pass" ? passed : status == "fail" ? failed : errors)++;
     }
+    for (auto& t : workers)
+        t.join();
+    out.flush();
+    cerr << "Batch: " << written << " jobs, " << passed << " passed, " << failed << " failed, " << errors << " errors\n";
+    return (bool)out && failed == 0 && errors == 0;
 }
 
-// utility: check if all instructions committed
-bool all_committed()
-{
-    for (auto &ins : program)
-        if (ins.commit == -1)
-            return false;
-    return true;
-}
-
-// single cycle step
-bool step()
+#ifndef TOMASULO_LIBRARY
+int main(int argc, char** argv)
 {
-    if (program.empty())
-        return false;
-    if (all_committed())
-        return false;
-
-    ++cycle_num;
+    ios::sync_with_stdio(false);
+    cin.tie(nullptr);
 
-    // order: execute -> write -> commit -> issue (roughly)
-    do_execute();
-    do_write();
-    do_commit();
-    // ISSUE stage: single-issue
-    for (int i = 0; i < ISSUE_WIDTH; ++i)
-        do_issue();
+    // -------------------- Converter --------------------
+    // tomasulo_sim --convert-program program.txt program.tpi [--no-text]
+    if (argc >= 4 && string(argv[1]) == "--convert-program")
+    {
+        bool with_text = !(argc >= 5 && string(argv[4]) == "--no-text");
+        Program prog;
+        if (!load_program_file(argv[2], prog) || !write_program_image(prog, argv[3], with_text))
+            return 1;
+        cout << "Wrote " << prog.instrs.size() << " instructions to " << argv[3] << "\n";
+        return 0;
+    }
 
-    return true;
-}
+    // tomasulo_sim --convert-memory memory.txt memory.tmi
+    if (argc >= 4 && string(argv[1]) == "--convert-memory")
+    {
+        shared_ptr<const MemoryImage> mem;
+        if (!load_memory_file(argv[2], mem))
+        {
+            cerr << "Cannot open memory file: " << argv[2] << "\n";
+            return 1;
+        }
+        if (!write_memory_image(mem, argv[3]))
+            return 1;
+        cout << "Wrote memory image " << argv[3] << "\n";
+        return 0;
+    }
 
-// ---------------- Reporting ----------------
-void print_report()
-{
-    cout << "\n===== Simulation Results =====\n";
-    cout << "Cycles: " << cycle_num << "\n";
-    int committed = (int)committed_log.size();
-    double ipc = (cycle_num > 0) ? (double)committed / cycle_num : 0.0;
-    cout << fixed << setprecision(3) << "IPC: " << ipc << "\n";
-    cout << "Instructions (executions): " << committed << "\n";
-    cout << "Branches: " << branch_count << "  Mispredictions: " << mispredictions << "\n\n";
+    // tomasulo_sim --generate program.txt|.tpi memory.txt|.tmi [key=value ...]
+    if (argc >= 4 && string(argv[1]) == "--generate")
+        return generate_workload(argv[2], argv[3], vector<string>(argv + 4, argv + argc)) ? 0 : 1;
 
-    cout << left << setw(5) << "ID" << setw(8) << "ADDR" << setw(8) << "OP" << setw(22) << "TEXT"
-        << setw(8) << "Issue" << setw(10) << "ExecS" << setw(10) << "ExecE" << setw(8) << "Write" << setw(8) << "Commit" << "\n";
-    for (auto& ins : committed_log)
-    {
-        string opname = OPCODES.count(ins.opcode) ? OPCODES.at(ins.opcode).name : "UNK";
-        cout << setw(5) << ins.id << setw(8) << ins.addr << setw(8) << opname << setw(22) << ins.text;
-        auto f = [](int x) -> string
-            { return x == -1 ? string("-") : to_string(x); };
-        cout << setw(8) << f(ins.issue) << setw(10) << f(ins.exec_start) << setw(10) << f(ins.exec_end)
-            << setw(8) << f(ins.write) << setw(8) << f(ins.commit) << "\n";
-    }
-    cout << "\nFinal registers (R0..R7):\n";
-    for (int i = 0; i < NUM_REG; ++i)
-        cout << "R" << i << ":" << wrap16(regs[i]) << (i == NUM_REG - 1 ? "\n" : "  ");
-    cout << "\nMemory nonzero values (first 256 addresses):\n";
-    int printed = 0;
-    for (int i = 0; i < 256 && i < MEM_SIZE; ++i)
+    // tomasulo_sim --read-trace trace.ttr [program] [--csv]
+    if (argc >= 3 && string(argv[1]) == "--read-trace")
     {
-        if (memory_mem[i] != 0)
+        bool csv = false;
+        unique_ptr<Program> prog;
+        for (int i = 3; i < argc; ++i)
         {
-            cout << "[" << i << "]=" << memory_mem[i] << "  ";
-            if (++printed % 8 == 0)
-                cout << "\n";
+            if (string(argv[i]) == "--csv")
+                csv = true;
+            else if (!load_program(argv[i], *(prog = make_unique<Program>())))
+                return 1;
         }
+        return read_trace(argv[2], csv, prog.get()) ? 0 : 1;
     }
-    if (printed == 0)
-        cout << "(none)\n";
-}
 
-int main()
-{
-    ios::sync_with_stdio(false);
-    cin.tie(nullptr);
+    // tomasulo_sim --bench-redirect
+    if (argc >= 2 && string(argv[1]) == "--bench-redirect")
+    {
+        bench_redirect();
+        return 0;
+    }
 
-    // -------------------- Hardcoded file paths --------------------
+    // -------------------- Options and file paths --------------------
     string progfile = "C:/AUC/Fall 25/Arch/test1.txt";
     string memfile = "C:/AUC/Fall 25/Arch/test1_mem.txt";
+    long long max_cycles = DEFAULT_MAX_CYCLES;
+    long long max_commits = DEFAULT_MAX_COMMITS;
+    bool max_commits_set = false; // sampled and SimPoint runs default to no cap
+    string tracefile;
+    string checkpoint_file, restore_file;
+    long long checkpoint_at = -1;
+    long long fast_forward = 0;
+    SamplingOptions sampling;
+    bool sampled = false;
+    SimPointOptions simpoint;
+    string out_file;
+    bool show_config = false;
+    bool event_driven = false;
+    bool cpi_stack = false;
+    bool profile = false;
+    int halt_pc = -1;
+    size_t history = DEFAULT_HISTORY;
+    string sweep_grid;
+    SweepOptions sweep;
+    string bench_suite;
+    BenchOptions bench;
+    string batch_manifest;
+    vector<string> files;
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        // options that take a number
+        auto number = [&](long long& out) -> bool
+            {
+                if (i + 1 >= argc)
+                    return false;
+                const char* v = argv[++i];
+                auto r = from_chars(v, v + strlen(v), out);
+                return r.ec == errc() && *r.ptr == '\0' && out >= 0;
+            };
+        long long n = 0;
+        if (arg == "--event-driven")
+            event_driven = true;
+        else if (arg == "--per-cycle")
+            event_driven = false;
+        else if (arg == "--trace" && i + 1 < argc)
+            tracefile = argv[++i];
+        else if (arg == "--config" && i + 1 < argc)
+        {
+            if (!load_config_file(cfg, argv[++i]))
+                return 1;
+        }
+        else if (arg == "--set" && i + 1 < argc)
+        {
+            if (!apply_config_line(cfg, argv[++i]))
+                return 1;
+        }
+        else if (arg == "--print-config")
+            show_config = true;
+        else if (arg == "--cpi-stack")
+            cpi_stack = true;
+        else if (arg == "--profile")
+            profile = true;
+        else if (arg == "--sample" && i + 1 < argc)
+        {
+            // FF,WARMUP,DETAIL
+            const char* v = argv[++i];
+            sampled = sscanf(v, "%lld,%lld,%lld", &sampling.fast_forward, &sampling.warmup, &sampling.detail) == 3
+                && sampling.fast_forward >= 0 && sampling.warmup >= 0 && sampling.detail > 0;
+            if (!sampled)
+            {
+                cerr << "--sample needs FF,WARMUP,DETAIL instruction counts\n";
+                return 1;
+            }
+        }
+        else if (arg == "--simpoint" && i + 1 < argc)
+        {
+            // INTERVAL,MAXK[,WARMUP]
+            const char* v = argv[++i];
+            int fields = sscanf(v, "%lld,%d,%lld", &simpoint.interval, &simpoint.max_k, &simpoint.warmup);
+            if (fields < 2 || simpoint.interval <= 0 || simpoint.max_k <= 0 || simpoint.warmup < 0)
+            {
+                cerr << "--simpoint needs INTERVAL,MAXK[,WARMUP]\n";
+                return 1;
+            }
+        }
+        else if (arg == "--restore" && i + 1 < argc)
+            restore_file = argv[++i];
+        else if (arg == "--checkpoint-at")
+        {
+            if (!number(checkpoint_at) || i + 1 >= argc)
+            {
+                cerr << "--checkpoint-at needs a cycle and a file\n";
+                return 1;
+            }
+            checkpoint_file = argv[++i];
+        }
+        else if (arg == "--sweep" && i + 1 < argc)
+            sweep_grid = argv[++i];
+        else if (arg == "--out" && i + 1 < argc)
+            out_file = argv[++i];
+        else if (arg == "--batch" && i + 1 < argc)
+            batch_manifest = argv[++i];
+        else if (arg == "--bench" && i + 1 < argc)
+            bench_suite = argv[++i];
+        else if (arg == "--baseline" && i + 1 < argc)
+            bench.baseline = argv[++i];
+        else if (arg == "--threshold" && i + 1 < argc)
+        {
+            char* end = nullptr;
+            bench.threshold = strtod(argv[++i], &end);
+            if (*end != '\0')
+            {
+                cerr << "--threshold needs a percentage\n";
+                return 1;
+            }
+        }
+        else if (arg == "--max-cycles" || arg == "--max-commits" || arg == "--halt-pc" || arg == "--history" || arg == "--threads" || arg == "--fast-forward"
+            || arg == "--reps")
+        {
+            if (!number(n))
+            {
+                cerr << arg << " needs a non-negative number\n";
+                return 1;
+            }
+            if (arg == "--max-cycles")
+                max_cycles = n ? n : LLONG_MAX;
+            else if (arg == "--max-commits")
+            {
+                max_commits = n;
+                max_commits_set = true;
+            }
+            else if (arg == "--halt-pc")
+                halt_pc = (int)n;
+            else if (arg == "--threads")
+                sweep.threads = (unsigned)n;
+            else if (arg == "--fast-forward")
+                fast_forward = n;
+            else if (arg == "--reps")
+                bench.reps = (int)max(1LL, n);
+            else
+                history = (size_t)n;
+        }
+        else if (arg.size() > 2 && arg.compare(0, 2, "--") == 0)
+        {
+            cerr << "Unknown option: " << arg << "\n";
+            return 1;
+        }
+        else
+            files.push_back(arg);
+    }
+    if (!validate_config(cfg))
+        return 1;
+    if (show_config)
+    {
+        print_config(cfg);
+        return 0;
+    }
+    if (!sweep_grid.empty())
+    {
+        sweep.max_cycles = max_cycles;
+        sweep.max_commits = max_commits;
+        sweep.event_driven = event_driven;
+        sweep.halt_pc = halt_pc;
+        if (!out_file.empty())
+            sweep.out = out_file;
+        return run_sweep(sweep_grid, sweep) ? 0 : 1;
+    }
+    if (!batch_manifest.empty())
+    {
+        BatchOptions batch;
+        batch.max_cycles = max_cycles;
+        batch.max_commits = max_commits;
+        batch.event_driven = event_driven;
+        batch.halt_pc = halt_pc;
+        batch.threads = sweep.threads;
+        batch.out = out_file;
+        return run_batch(batch_manifest, batch) ? 0 : 1;
+    }
+    if (!bench_suite.empty())
+    {
+        bench.event_driven = event_driven;
+        bench.out = out_file;
+        return run_bench_suite(bench_suite, bench) ? 0 : 1;
+    }
+    if (files.size() >= 1)
+        progfile = files[0];
+    if (files.size() >= 2)
+        memfile = files[1];
 
     // -------------------- Load program --------------------
-    if (!load_program_file(progfile))
+    auto prog = make_shared<Program>();
+    prog->num_reg = cfg.num_reg;
+    if (!load_program(progfile, *prog))
     {
         cerr << "Failed to load program file: " << progfile << "\n";
         return 1;
     }
 
      //-------------------- Load memory (optional) --------------------
-    if (!load_memory_file(memfile))
+    shared_ptr<const MemoryImage> mem;
+    if (!load_memory(memfile, mem))
     {
         cerr << "Warning: Could not open memory file: " << memfile << "\n";
         //continue; memory stays zero
     }
 
+    if (simpoint.interval > 0)
+    {
+        simpoint.max_cycles = max_cycles;
+        simpoint.max_instrs = max_commits_set ? max_commits : 0;
+        simpoint.event_driven = event_driven;
+        simpoint.halt_pc = halt_pc;
+        simpoint.threads = sweep.threads;
+        simpoint.out = out_file;
+        return run_simpoint(prog, mem, simpoint) ? 0 : 1;
+    }
+
+    if (sampled)
+    {
+        long long period = sampling.fast_forward + sampling.warmup + sampling.detail;
+        if (!max_commits_set)
+            max_commits = 0;
+        else if (max_commits > 0 && max_commits < period)
+        {
+            cerr << "--max-commits " << max_commits << " is shorter than one --sample period (" << period
+                 << " instructions)\n";
+            return 1;
+        }
+    }
+
     // -------------------- Initialize structures --------------------
-    init_structures();
+    Simulator sim(cfg, prog, mem);
+    sim.event_driven = event_driven;
+    sim.halt_pc = halt_pc;
+    sim.committed_log.capacity = history;
+    sim.init_structures();
+    if (!restore_file.empty() && !sim.restore_checkpoint_file(restore_file))
+        return 1;
+    if (!tracefile.empty())
+    {
+        sim.trace_out = make_unique<TraceWriter>();
+        if (!sim.trace_out->open(tracefile))
+        {
+            cerr << "Cannot write trace file: " << tracefile << "\n";
+            return 1;
+        }
+    }
 
     // -------------------- Simulation loop --------------------
-    const int max_cycles = DEFAULT_MAX_CYCLES;
-    int steps = 0;
-    while (steps < max_cycles && (int)committed_log.size() < MAX_EXECUTIONS)
+    if (fast_forward > 0)
+        sim.fast_forward(fast_forward);
+    if (profile)
+        sim.start_profile();
+    if (sampled)
     {
-        if (!step())
-            break;
-        ++steps;
+        SampleReport rep = sim.run_sampled(sampling, max_cycles, max_commits);
+        if (profile)
+            sim.stop_profile();
+        print_sample_report(rep);
+        if (cpi_stack)
+            sim.print_cpi_stack();
+        if (profile)
+            sim.print_profile();
+        if (sim.trace_out && !sim.trace_out->close())
+            cerr << "Warning: trace file " << tracefile << " is incomplete\n";
+        return 0;
     }
+    // cycle limits are absolute, so a restored run stops where the original would have
+    if (checkpoint_at >= sim.cycle_num)
+    {
+        sim.run(min(max_cycles, checkpoint_at) - sim.cycle_num, max_commits);
+        if (!sim.save_checkpoint_file(checkpoint_file))
+            return 1;
+    }
+    if (max_cycles > sim.cycle_num)
+        sim.run(max_cycles - sim.cycle_num, max_commits);
+    if (profile)
+        sim.stop_profile();
+
+    if (sim.trace_out && !sim.trace_out->close())
+        cerr << "Warning: trace file " << tracefile << " is incomplete\n";
 
     // -------------------- Print results --------------------
-    print_report();
+    sim.print_report();
+    if (cpi_stack)
+        sim.print_cpi_stack();
+    if (profile)
+        sim.print_profile();
 
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,235 @@
+// tomasulo.h
+// Embeddable simulator API (libtomasulo). Plain C, with a thin C++ wrapper
+// at the bottom.
+// Build: g++ -std=c++17 -O2 -pthread -fPIC -shared -DTOMASULO_LIBRARY main.cpp -o libtomasulo.so
+//
+// Each tomasulo_sim is an independent simulator; separate instances can run
+// on separate threads. The inspection calls return pointers straight into
+// the simulator's state: they stay valid until the next call that steps,
+// resets or reloads that instance.
+// No call lets a C++ exception escape: failures come back as the error
+// value (nonzero, NULL or 0) instead.
+
+#ifndef TOMASULO_H
+#define TOMASULO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TOMASULO_MEM_PAGE_WORDS 256
+#define TOMASULO_MEM_PAGES 256
+
+// ROB entry kinds (tomasulo_rob_entry.type)
+enum
+{
+    TOMASULO_ROB_NONE,
+    TOMASULO_ROB_REG,
+    TOMASULO_ROB_STORE,
+    TOMASULO_ROB_BR,
+    TOMASULO_ROB_CALL,
+    TOMASULO_ROB_RET,
+    TOMASULO_ROB_HALT
+};
+
+// reservation-station families (tomasulo_rs_family)
+enum
+{
+    TOMASULO_RS_LOAD,
+    TOMASULO_RS_STORE,
+    TOMASULO_RS_BR,
+    TOMASULO_RS_ADD,
+    TOMASULO_RS_NAND,
+    TOMASULO_RS_MUL,
+    TOMASULO_RS_CALL,
+    TOMASULO_RS_RET,
+    TOMASULO_RS_FAMILIES
+};
+
+typedef struct tomasulo_rob_entry
+{
+    uint8_t busy;
+    uint8_t type;
+    int32_t dest; // register (REG) or memory address (STORE)
+    int32_t value;
+    uint8_t ready;
+    int32_t instr_id; // program index
+    int32_t pc_on_issue;
+    int32_t br_target;
+    int32_t commit_remaining;
+} tomasulo_rob_entry;
+
+typedef struct tomasulo_rs
+{
+    uint8_t busy;
+    int32_t opcode;
+    int32_t rob_dest;
+    int32_t Vj, Vk;
+    int32_t Qj, Qk; // producing ROB tags, -1 when the value is in Vj/Vk
+    int32_t A;
+    uint8_t exec_started;
+    uint8_t exec_finished;
+    int64_t exec_done;
+    int32_t write_remaining;
+    int32_t instr_id;
+} tomasulo_rs;
+
+typedef struct tomasulo_stats
+{
+    int64_t cycles;
+    int64_t committed;
+    int64_t branches;
+    int64_t mispredictions;
+    int32_t pc;
+    int32_t halted;    // HALT committed or the halt PC was reached
+    int32_t halted_at;
+    int32_t finished;  // nothing left to run: halted, or every instruction committed
+} tomasulo_stats;
+
+typedef struct tomasulo_sim tomasulo_sim;
+
+// config: machine configuration in config-file syntax ("rob_size = 16\n..."), or NULL for the defaults.
+// Returns NULL if the configuration is invalid.
+tomasulo_sim* tomasulo_create(const char* config);
+void tomasulo_destroy(tomasulo_sim* sim);
+
+// Program (text or binary image) and memory (text or binary image) from bytes,
+// which are copied. Loading resets the run. Return 0 on success.
+int tomasulo_load_program(tomasulo_sim* sim, const void* data, size_t size);
+int tomasulo_load_memory(tomasulo_sim* sim, const void* data, size_t size);
+// --halt-pc equivalent, -1 to disable; applies from the next step, and to
+// runs after a reset or reload
+void tomasulo_set_halt_pc(tomasulo_sim* sim, int32_t pc);
+
+// back to cycle 0 with the loaded program and the initial memory
+void tomasulo_reset(tomasulo_sim* sim);
+
+// Advance up to n cycles; returns the number run (fewer once the run is finished)
+uint64_t tomasulo_step(tomasulo_sim* sim, uint64_t n);
+
+// Step until pred returns nonzero (checked after every cycle), the run
+// finishes, or max_cycles have run. Returns the number of cycles run.
+typedef int (*tomasulo_predicate)(const tomasulo_sim* sim, void* user);
+uint64_t tomasulo_run_until(tomasulo_sim* sim, tomasulo_predicate pred, void* user, uint64_t max_cycles);
+
+void tomasulo_get_stats(const tomasulo_sim* sim, tomasulo_stats* out);
+
+// Snapshot of the whole machine state (memory is stored as the pages that
+// differ from the loaded image). The blob is owned by sim and valid until the
+// next tomasulo_checkpoint; copy it to keep several. NULL before a program is
+// loaded.
+const void* tomasulo_checkpoint(tomasulo_sim* sim, size_t* size);
+// Continue from a checkpoint, with the same subsequent timing as the original
+// run. sim must have the same program and memory loaded and the same ROB, RS
+// and register counts; latencies and issue width may differ (what-if runs).
+// Returns 0 on success; on failure the run is reset.
+int tomasulo_restore(tomasulo_sim* sim, const void* data, size_t size);
+
+// Zero-copy views of the current state
+const tomasulo_rob_entry* tomasulo_rob(const tomasulo_sim* sim, int32_t* size, int32_t* head, int32_t* count);
+const tomasulo_rs* tomasulo_rs_family(const tomasulo_sim* sim, int32_t family, int32_t* size);
+const int32_t* tomasulo_regs(const tomasulo_sim* sim, int32_t* size);
+// One 256-word memory page (addresses page*256 ..), never NULL; a page that
+// was never written or loaded reads as a shared zero page
+const uint16_t* tomasulo_mem_page(const tomasulo_sim* sim, int32_t page);
+
+#ifdef __cplusplus
+} // extern "C"
+
+#include <string>
+
+namespace tomasulo
+{
+    template <class T>
+    struct Span
+    {
+        const T* data = nullptr;
+        size_t size = 0;
+        const T* begin() const { return data; }
+        const T* end() const { return data + size; }
+        const T& operator[](size_t i) const { return data[i]; }
+    };
+
+    // Owning handle over the C API
+    class Sim
+    {
+    public:
+        explicit Sim(const char* config = nullptr) : h(tomasulo_create(config)) {}
+        ~Sim() { tomasulo_destroy(h); }
+        Sim(const Sim&) = delete;
+        Sim& operator=(const Sim&) = delete;
+
+        bool ok() const { return h != nullptr; }
+        tomasulo_sim* handle() const { return h; }
+
+        bool load_program(const void* data, size_t size) { return tomasulo_load_program(h, data, size) == 0; }
+        bool load_memory(const void* data, size_t size) { return tomasulo_load_memory(h, data, size) == 0; }
+        void reset() { tomasulo_reset(h); }
+        uint64_t step(uint64_t n = 1) { return tomasulo_step(h, n); }
+
+        // pred() -> bool, called after every cycle
+        template <class F>
+        uint64_t run_until(F pred, uint64_t max_cycles)
+        {
+            return tomasulo_run_until(h, [](const tomasulo_sim*, void* user) -> int { return (*(F*)user)() ? 1 : 0; }, &pred, max_cycles);
+        }
+
+        std::string checkpoint()
+        {
+            size_t size = 0;
+            const char* p = (const char*)tomasulo_checkpoint(h, &size);
+            return p ? std::string(p, size) : std::string();
+        }
+        bool restore(const std::string& blob) { return tomasulo_restore(h, blob.data(), blob.size()) == 0; }
+
+        tomasulo_stats stats() const
+        {
+            tomasulo_stats s;
+            tomasulo_get_stats(h, &s);
+            return s;
+        }
+
+        Span<tomasulo_rob_entry> rob() const
+        {
+            int32_t size, head, count;
+            const tomasulo_rob_entry* p = tomasulo_rob(h, &size, &head, &count);
+            return { p, (size_t)size };
+        }
+        // in-flight entries are rob()[(head + i) % size] for i < count
+        int32_t rob_head() const
+        {
+            int32_t size, head, count;
+            tomasulo_rob(h, &size, &head, &count);
+            return head;
+        }
+        int32_t rob_count() const
+        {
+            int32_t size, head, count;
+            tomasulo_rob(h, &size, &head, &count);
+            return count;
+        }
+        Span<tomasulo_rs> rs(int family) const
+        {
+            int32_t size;
+            const tomasulo_rs* p = tomasulo_rs_family(h, family, &size);
+            return { p, (size_t)size };
+        }
+        Span<int32_t> regs() const
+        {
+            int32_t size;
+            const int32_t* p = tomasulo_regs(h, &size);
+            return { p, (size_t)size };
+        }
+        Span<uint16_t> mem_page(int page) const { return { tomasulo_mem_page(h, page), TOMASULO_MEM_PAGE_WORDS }; }
+        uint16_t mem(int addr) const { return tomasulo_mem_page(h, addr / TOMASULO_MEM_PAGE_WORDS)[addr % TOMASULO_MEM_PAGE_WORDS]; }
+
+    private:
+        tomasulo_sim* h;
+    };
+}
+#endif
+
+#endif